@@ -69,6 +69,10 @@ static inline int __must_check kref_get_unless_zero(struct kref *kref)
 #define SIZE_MAX (~(size_t)0)
 #endif
 
+#ifndef NUMA_NO_NODE
+#define NUMA_NO_NODE (-1)
+#endif
+
 #ifndef kvfree
 #define kvfree drm_kvfree
 static inline void kvfree(const void *addr)
@@ -67,6 +67,85 @@ EXPORT_SYMBOL(reservation_seqcount_class);
 const char reservation_seqcount_string[] = "reservation_seqcount";
 EXPORT_SYMBOL(reservation_seqcount_string);
 
+/**
+ * reservation_object_compact_shared - Drop signaled fences from a shared
+ * fence list in place, and optionally add a fence.
+ * @obj: reservation object
+ * @fobj: the current shared fence list of @obj
+ * @fence: fence to add, or NULL
+ *
+ * Signaled fences, and the fence of the same context as @fence if any,
+ * are removed from @fobj. If @fence is non-NULL, it is then added to
+ * the list, which must have a free slot. This keeps the shared fence
+ * list of heavily shared objects short, also without exclusive fences
+ * being added. Must be called with obj->lock held.
+ */
+static void
+reservation_object_compact_shared(struct reservation_object *obj,
+				  struct reservation_object_list *fobj,
+				  struct dma_fence *fence)
+{
+	u32 i, count, old_count = fobj->shared_count;
+	struct dma_fence *check;
+
+	/*
+	 * Update the signaled state of the fences outside of the seqcount
+	 * write section, since that may call into the fence drivers.
+	 */
+	for (i = 0; i < old_count; ++i) {
+		check = rcu_dereference_protected(fobj->shared[i],
+						  reservation_object_held(obj));
+		(void) dma_fence_is_signaled(check);
+	}
+
+	if (fence)
+		dma_fence_get(fence);
+
+	preempt_disable();
+	write_seqcount_begin(&obj->seq);
+
+	/*
+	 * Move dead fences to the end of the list. Readers will retry, so
+	 * the order may be changed freely.
+	 */
+	count = old_count;
+	for (i = 0; i < count;) {
+		check = rcu_dereference_protected(fobj->shared[i],
+						  reservation_object_held(obj));
+
+		if ((fence && check->context == fence->context) ||
+		    test_bit(DMA_FENCE_FLAG_SIGNALED_BIT, &check->flags)) {
+			RCU_INIT_POINTER(fobj->shared[i],
+					 rcu_dereference_protected
+					 (fobj->shared[count - 1],
+					  reservation_object_held(obj)));
+			RCU_INIT_POINTER(fobj->shared[--count], check);
+		} else {
+			++i;
+		}
+	}
+
+	if (fence) {
+		/* Dead fences end up at [count + 1, old_count + 1). */
+		RCU_INIT_POINTER(fobj->shared[old_count],
+				 rcu_dereference_protected
+				 (fobj->shared[count],
+				  reservation_object_held(obj)));
+		RCU_INIT_POINTER(fobj->shared[count], fence);
+		fobj->shared_count = ++count;
+		++old_count;
+	} else {
+		fobj->shared_count = count;
+	}
+
+	write_seqcount_end(&obj->seq);
+	preempt_enable();
+
+	for (i = count; i < old_count; ++i)
+		dma_fence_put(rcu_dereference_protected
+			      (fobj->shared[i], reservation_object_held(obj)));
+}
+
 /**
  * reservation_object_reserve_shared - Reserve space to add a shared
  * fence to a reservation_object.
@@ -86,6 +165,10 @@ int reservation_object_reserve_shared(struct reservation_object *obj)
 	old = reservation_object_get_list(obj);
 
 	if (old && old->shared_max) {
+		/* Try to make room by dropping signaled fences. */
+		if (old->shared_count == old->shared_max)
+			reservation_object_compact_shared(obj, old, NULL);
+
 		if (old->shared_count < old->shared_max) {
 			/* perform an in-place update */
 			kfree(obj->staged);
@@ -111,54 +194,13 @@ int reservation_object_reserve_shared(struct reservation_object *obj)
 }
 EXPORT_SYMBOL(reservation_object_reserve_shared);
 
-static void
-reservation_object_add_shared_inplace(struct reservation_object *obj,
-				      struct reservation_object_list *fobj,
-				      struct dma_fence *fence)
-{
-	u32 i;
-
-	dma_fence_get(fence);
-
-	preempt_disable();
-	write_seqcount_begin(&obj->seq);
-
-	for (i = 0; i < fobj->shared_count; ++i) {
-		struct dma_fence *old_fence;
-
-		old_fence = rcu_dereference_protected(fobj->shared[i],
-						reservation_object_held(obj));
-
-		if (old_fence->context == fence->context) {
-			/* memory barrier is added by write_seqcount_begin */
-			RCU_INIT_POINTER(fobj->shared[i], fence);
-			write_seqcount_end(&obj->seq);
-			preempt_enable();
-
-			dma_fence_put(old_fence);
-			return;
-		}
-	}
-
-	/*
-	 * memory barrier is added by write_seqcount_begin,
-	 * fobj->shared_count is protected by this lock too
-	 */
-	RCU_INIT_POINTER(fobj->shared[fobj->shared_count], fence);
-	fobj->shared_count++;
-
-	write_seqcount_end(&obj->seq);
-	preempt_enable();
-}
-
 static void
 reservation_object_add_shared_replace(struct reservation_object *obj,
 				      struct reservation_object_list *old,
 				      struct reservation_object_list *fobj,
 				      struct dma_fence *fence)
 {
-	unsigned i;
-	struct dma_fence *old_fence = NULL;
+	unsigned i, j, k = fobj->shared_max;
 
 	dma_fence_get(fence);
 
@@ -172,26 +214,26 @@ reservation_object_add_shared_replace(struct reservation_object *obj,
 	 * no need to bump fence refcounts, rcu_read access
 	 * requires the use of kref_get_unless_zero, and the
 	 * references from the old struct are carried over to
-	 * the new.
+	 * the new. Signaled fences and the fence replaced by @fence
+	 * are collected at the end of the new list and put once the
+	 * new list is published. The new list is at least twice the
+	 * size of the old one, so they never overlap the live fences.
 	 */
-	fobj->shared_count = old->shared_count;
-
+	j = 0;
 	for (i = 0; i < old->shared_count; ++i) {
 		struct dma_fence *check;
 
 		check = rcu_dereference_protected(old->shared[i],
 						reservation_object_held(obj));
 
-		if (!old_fence && check->context == fence->context) {
-			old_fence = check;
-			RCU_INIT_POINTER(fobj->shared[i], fence);
-		} else
-			RCU_INIT_POINTER(fobj->shared[i], check);
-	}
-	if (!old_fence) {
-		RCU_INIT_POINTER(fobj->shared[fobj->shared_count], fence);
-		fobj->shared_count++;
+		if (check->context == fence->context ||
+		    dma_fence_is_signaled(check))
+			RCU_INIT_POINTER(fobj->shared[--k], check);
+		else
+			RCU_INIT_POINTER(fobj->shared[j++], check);
 	}
+	RCU_INIT_POINTER(fobj->shared[j++], fence);
+	fobj->shared_count = j;
 
 done:
 	preempt_disable();
@@ -204,11 +246,14 @@ done:
 	write_seqcount_end(&obj->seq);
 	preempt_enable();
 
-	if (old)
-		kfree_rcu(old, rcu);
+	if (!old)
+		return;
 
-	if (old_fence)
-		dma_fence_put(old_fence);
+	kfree_rcu(old, rcu);
+
+	for (i = k; i < fobj->shared_max; ++i)
+		dma_fence_put(rcu_dereference_protected
+			      (fobj->shared[i], reservation_object_held(obj)));
 }
 
 /**
@@ -229,7 +274,7 @@ void reservation_object_add_shared_fence(struct reservation_object *obj,
 
 	if (!fobj) {
 		BUG_ON(old->shared_count >= old->shared_max);
-		reservation_object_add_shared_inplace(obj, old, fence);
+		reservation_object_compact_shared(obj, old, fence);
 	} else
 		reservation_object_add_shared_replace(obj, old, fobj, fence);
 }
@@ -70,10 +70,12 @@
  *
  * drm_mm maintains a stack of most recently freed holes, which of all
  * simplistic datastructures seems to be a fairly decent approach to clustering
- * allocations and avoiding too much fragmentation. This means free space
- * searches are O(num_holes). Given that all the fancy features drm_mm supports
- * something better would be fairly complex and since gfx thrashing is a fairly
- * steep cliff not a real concern. Removing a node again is O(1).
+ * allocations and avoiding too much fragmentation. The holes are additionally
+ * indexed in an rbtree by size and in an rbtree by address. Best fit searches
+ * start at the smallest hole that is large enough, and searches for which no
+ * hole is large enough fail right away, both in O(log(num_holes)). Other
+ * searches walk the stack, which is O(num_holes). Removing a node again is
+ * O(log(num_holes)).
  *
  * drm_mm supports a few features: Alignment and range restrictions can be
  * supplied. Further more every &drm_mm_node has a color value (which is just an
@@ -103,6 +105,105 @@ static struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_
 						u64 end,
 						enum drm_mm_search_flags flags);
 
+static void drm_mm_index_hole(struct drm_mm_node *node)
+{
+	struct drm_mm *mm = node->mm;
+	struct rb_node **link, *parent;
+	u64 hole_start = __drm_mm_hole_node_start(node);
+
+	node->hole_size = __drm_mm_hole_node_end(node) - hole_start;
+
+	link = &mm->holes_size.rb_node;
+	parent = NULL;
+	while (*link) {
+		parent = *link;
+		if (node->hole_size < rb_entry(parent, struct drm_mm_node,
+					       rb_hole_size)->hole_size)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&node->rb_hole_size, parent, link);
+	rb_insert_color(&node->rb_hole_size, &mm->holes_size);
+
+	link = &mm->holes_addr.rb_node;
+	parent = NULL;
+	while (*link) {
+		parent = *link;
+		if (hole_start < __drm_mm_hole_node_start
+		    (rb_entry(parent, struct drm_mm_node, rb_hole_addr)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&node->rb_hole_addr, parent, link);
+	rb_insert_color(&node->rb_hole_addr, &mm->holes_addr);
+}
+
+static void drm_mm_unindex_hole(struct drm_mm_node *node)
+{
+	rb_erase(&node->rb_hole_size, &node->mm->holes_size);
+	rb_erase(&node->rb_hole_addr, &node->mm->holes_addr);
+	node->hole_size = 0;
+}
+
+/* Smallest hole of at least @size, or NULL */
+static struct drm_mm_node *drm_mm_best_hole(const struct drm_mm *mm, u64 size)
+{
+	struct rb_node *rb = mm->holes_size.rb_node;
+	struct drm_mm_node *best = NULL;
+
+	while (rb) {
+		struct drm_mm_node *node =
+			rb_entry(rb, struct drm_mm_node, rb_hole_size);
+
+		if (node->hole_size >= size) {
+			best = node;
+			rb = rb->rb_left;
+		} else {
+			rb = rb->rb_right;
+		}
+	}
+
+	return best;
+}
+
+static struct drm_mm_node *drm_mm_next_hole_size(struct drm_mm_node *node)
+{
+	struct rb_node *rb = rb_next(&node->rb_hole_size);
+
+	return rb ? rb_entry(rb, struct drm_mm_node, rb_hole_size) : NULL;
+}
+
+static bool drm_mm_has_hole(const struct drm_mm *mm, u64 size)
+{
+	struct rb_node *rb = rb_last(&mm->holes_size);
+
+	return rb && rb_entry(rb, struct drm_mm_node,
+			      rb_hole_size)->hole_size >= size;
+}
+
+/* Hole starting at or closest below @addr, or NULL */
+static struct drm_mm_node *drm_mm_find_hole(struct drm_mm *mm, u64 addr)
+{
+	struct rb_node *rb = mm->holes_addr.rb_node;
+	struct drm_mm_node *hole = NULL;
+
+	while (rb) {
+		struct drm_mm_node *node =
+			rb_entry(rb, struct drm_mm_node, rb_hole_addr);
+
+		if (addr < __drm_mm_hole_node_start(node)) {
+			rb = rb->rb_left;
+		} else {
+			hole = node;
+			rb = rb->rb_right;
+		}
+	}
+
+	return hole;
+}
+
 static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 				 struct drm_mm_node *node,
 				 u64 size, unsigned alignment,
@@ -139,6 +240,7 @@ static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 	BUG_ON(adj_start < hole_start);
 	BUG_ON(adj_end > hole_end);
 
+	drm_mm_unindex_hole(hole_node);
 	if (adj_start == hole_start) {
 		hole_node->hole_follows = 0;
 		list_del(&hole_node->hole_stack);
@@ -159,7 +261,11 @@ static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 	if (__drm_mm_hole_node_start(node) < hole_end) {
 		list_add(&node->hole_stack, &mm->hole_stack);
 		node->hole_follows = 1;
+		drm_mm_index_hole(node);
 	}
+
+	if (hole_node->hole_follows)
+		drm_mm_index_hole(hole_node);
 }
 
 /**
@@ -188,31 +294,38 @@ int drm_mm_reserve_node(struct drm_mm *mm, struct drm_mm_node *node)
 	end = node->start + node->size;
 
 	/* Find the relevant hole to add our node to */
-	drm_mm_for_each_hole(hole, mm, hole_start, hole_end) {
-		if (hole_start > node->start || hole_end < end)
-			continue;
+	hole = drm_mm_find_hole(mm, node->start);
+	if (!hole)
+		return -ENOSPC;
 
-		node->mm = mm;
-		node->allocated = 1;
+	hole_start = drm_mm_hole_node_start(hole);
+	hole_end = drm_mm_hole_node_end(hole);
+	if (hole_start > node->start || hole_end < end)
+		return -ENOSPC;
 
-		INIT_LIST_HEAD(&node->hole_stack);
-		list_add(&node->node_list, &hole->node_list);
+	node->mm = mm;
+	node->allocated = 1;
 
-		if (node->start == hole_start) {
-			hole->hole_follows = 0;
-			list_del_init(&hole->hole_stack);
-		}
+	drm_mm_unindex_hole(hole);
+	INIT_LIST_HEAD(&node->hole_stack);
+	list_add(&node->node_list, &hole->node_list);
 
-		node->hole_follows = 0;
-		if (end != hole_end) {
-			list_add(&node->hole_stack, &mm->hole_stack);
-			node->hole_follows = 1;
-		}
+	if (node->start == hole_start) {
+		hole->hole_follows = 0;
+		list_del_init(&hole->hole_stack);
+	}
 
-		return 0;
+	node->hole_follows = 0;
+	if (end != hole_end) {
+		list_add(&node->hole_stack, &mm->hole_stack);
+		node->hole_follows = 1;
+		drm_mm_index_hole(node);
 	}
 
-	return -ENOSPC;
+	if (hole->hole_follows)
+		drm_mm_index_hole(hole);
+
+	return 0;
 }
 EXPORT_SYMBOL(drm_mm_reserve_node);
 
@@ -288,6 +401,7 @@ static void drm_mm_insert_helper_range(struct drm_mm_node *hole_node,
 		}
 	}
 
+	drm_mm_unindex_hole(hole_node);
 	if (adj_start == hole_start) {
 		hole_node->hole_follows = 0;
 		list_del(&hole_node->hole_stack);
@@ -311,7 +425,11 @@ static void drm_mm_insert_helper_range(struct drm_mm_node *hole_node,
 	if (__drm_mm_hole_node_start(node) < hole_end) {
 		list_add(&node->hole_stack, &mm->hole_stack);
 		node->hole_follows = 1;
+		drm_mm_index_hole(node);
 	}
+
+	if (hole_node->hole_follows)
+		drm_mm_index_hole(hole_node);
 }
 
 /**
@@ -379,6 +497,7 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 		BUG_ON(__drm_mm_hole_node_start(node) ==
 		       __drm_mm_hole_node_end(node));
 		list_del(&node->hole_stack);
+		drm_mm_unindex_hole(node);
 	} else
 		BUG_ON(__drm_mm_hole_node_start(node) !=
 		       __drm_mm_hole_node_end(node));
@@ -387,10 +506,13 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 	if (!prev_node->hole_follows) {
 		prev_node->hole_follows = 1;
 		list_add(&prev_node->hole_stack, &mm->hole_stack);
-	} else
+	} else {
 		list_move(&prev_node->hole_stack, &mm->hole_stack);
+		drm_mm_unindex_hole(prev_node);
+	}
 
 	list_del(&node->node_list);
+	drm_mm_index_hole(prev_node);
 	node->allocated = 0;
 }
 EXPORT_SYMBOL(drm_mm_remove_node);
@@ -419,39 +541,48 @@ static struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
 						      enum drm_mm_search_flags flags)
 {
 	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
 	u64 adj_start;
 	u64 adj_end;
-	u64 best_size;
 
 	BUG_ON(mm->scanned_blocks);
 
-	best = NULL;
-	best_size = ~0UL;
+	if (!drm_mm_has_hole(mm, size))
+		return NULL;
+
+	if (flags & DRM_MM_SEARCH_BEST) {
+		for (entry = drm_mm_best_hole(mm, size); entry;
+		     entry = drm_mm_next_hole_size(entry)) {
+			adj_start = drm_mm_hole_node_start(entry);
+			adj_end = drm_mm_hole_node_end(entry);
+
+			if (mm->color_adjust) {
+				mm->color_adjust(entry, color, &adj_start,
+						 &adj_end);
+				if (adj_end <= adj_start)
+					continue;
+			}
+
+			if (check_free_hole(adj_start, adj_end, size,
+					    alignment))
+				return entry;
+		}
+
+		return NULL;
+	}
 
 	__drm_mm_for_each_hole(entry, mm, adj_start, adj_end,
 			       flags & DRM_MM_SEARCH_BELOW) {
-		u64 hole_size = adj_end - adj_start;
-
 		if (mm->color_adjust) {
 			mm->color_adjust(entry, color, &adj_start, &adj_end);
 			if (adj_end <= adj_start)
 				continue;
 		}
 
-		if (!check_free_hole(adj_start, adj_end, size, alignment))
-			continue;
-
-		if (!(flags & DRM_MM_SEARCH_BEST))
+		if (check_free_hole(adj_start, adj_end, size, alignment))
 			return entry;
-
-		if (hole_size < best_size) {
-			best = entry;
-			best_size = hole_size;
-		}
 	}
 
-	return best;
+	return NULL;
 }
 
 static struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_mm *mm,
@@ -463,20 +594,42 @@ static struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_
 							enum drm_mm_search_flags flags)
 {
 	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
 	u64 adj_start;
 	u64 adj_end;
-	u64 best_size;
 
 	BUG_ON(mm->scanned_blocks);
 
-	best = NULL;
-	best_size = ~0UL;
+	if (!drm_mm_has_hole(mm, size))
+		return NULL;
+
+	if (flags & DRM_MM_SEARCH_BEST) {
+		for (entry = drm_mm_best_hole(mm, size); entry;
+		     entry = drm_mm_next_hole_size(entry)) {
+			adj_start = drm_mm_hole_node_start(entry);
+			adj_end = drm_mm_hole_node_end(entry);
+
+			if (adj_start < start)
+				adj_start = start;
+			if (adj_end > end)
+				adj_end = end;
+
+			if (mm->color_adjust) {
+				mm->color_adjust(entry, color, &adj_start,
+						 &adj_end);
+				if (adj_end <= adj_start)
+					continue;
+			}
+
+			if (check_free_hole(adj_start, adj_end, size,
+					    alignment))
+				return entry;
+		}
+
+		return NULL;
+	}
 
 	__drm_mm_for_each_hole(entry, mm, adj_start, adj_end,
 			       flags & DRM_MM_SEARCH_BELOW) {
-		u64 hole_size = adj_end - adj_start;
-
 		if (adj_start < start)
 			adj_start = start;
 		if (adj_end > end)
@@ -488,19 +641,11 @@ static struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_
 				continue;
 		}
 
-		if (!check_free_hole(adj_start, adj_end, size, alignment))
-			continue;
-
-		if (!(flags & DRM_MM_SEARCH_BEST))
+		if (check_free_hole(adj_start, adj_end, size, alignment))
 			return entry;
-
-		if (hole_size < best_size) {
-			best = entry;
-			best_size = hole_size;
-		}
 	}
 
-	return best;
+	return NULL;
 }
 
 /**
@@ -516,6 +661,13 @@ void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new)
 {
 	list_replace(&old->node_list, &new->node_list);
 	list_replace(&old->hole_stack, &new->hole_stack);
+	if (old->hole_follows) {
+		rb_replace_node(&old->rb_hole_size, &new->rb_hole_size,
+				&old->mm->holes_size);
+		rb_replace_node(&old->rb_hole_addr, &new->rb_hole_addr,
+				&old->mm->holes_addr);
+	}
+	new->hole_size = old->hole_size;
 	new->hole_follows = old->hole_follows;
 	new->mm = old->mm;
 	new->start = old->start;
@@ -758,6 +910,10 @@ void drm_mm_init(struct drm_mm * mm, u64 start, u64 size)
 	mm->head_node.size = start - mm->head_node.start;
 	list_add_tail(&mm->head_node.hole_stack, &mm->hole_stack);
 
+	mm->holes_size = RB_ROOT;
+	mm->holes_addr = RB_ROOT;
+	drm_mm_index_hole(&mm->head_node);
+
 	mm->color_adjust = NULL;
 }
 EXPORT_SYMBOL(drm_mm_init);
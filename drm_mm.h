@@ -39,6 +39,7 @@
 #include <linux/bug.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/spinlock.h>
 #ifdef CONFIG_DEBUG_FS
 #include <linux/seq_file.h>
@@ -61,6 +62,9 @@ enum drm_mm_allocator_flags {
 struct drm_mm_node {
 	struct list_head node_list;
 	struct list_head hole_stack;
+	struct rb_node rb_hole_size;
+	struct rb_node rb_hole_addr;
+	u64 hole_size;
 	unsigned hole_follows : 1;
 	unsigned scanned_block : 1;
 	unsigned scanned_prev_free : 1;
@@ -76,6 +80,9 @@ struct drm_mm_node {
 struct drm_mm {
 	/* List of all memory nodes that immediately precede a free hole. */
 	struct list_head hole_stack;
+	/* The same nodes, indexed by hole size and by hole address. */
+	struct rb_root holes_size;
+	struct rb_root holes_addr;
 	/* head_node.node_list is the list of all memory nodes, ordered
 	 * according to the (increasing) start address of the memory node. */
 	struct drm_mm_node head_node;
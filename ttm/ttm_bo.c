@@ -564,15 +564,98 @@ static int ttm_bo_cleanup_refs_and_unlock(struct ttm_buffer_object *bo,
 	return 0;
 }
 
+/*
+ * Return a reference to an unsignaled fence of a reserved bo, or NULL if
+ * the bo is idle.
+ */
+static struct dma_fence *ttm_bo_busy_fence(struct ttm_buffer_object *bo)
+{
+	struct reservation_object_list *fobj;
+	struct dma_fence *fence;
+	int i;
+
+	fence = reservation_object_get_excl(bo->resv);
+	if (fence && !dma_fence_is_signaled(fence))
+		return dma_fence_get(fence);
+
+	fobj = reservation_object_get_list(bo->resv);
+	for (i = 0; fobj && i < fobj->shared_count; ++i) {
+		fence = rcu_dereference_protected(fobj->shared[i],
+					reservation_object_held(bo->resv));
+		if (!dma_fence_is_signaled(fence))
+			return dma_fence_get(fence);
+	}
+
+	return NULL;
+}
+
+static void ttm_bo_delayed_delete_cb(struct dma_fence *fence,
+				     struct dma_fence_cb *cb)
+{
+	struct ttm_bo_device *bdev =
+		container_of(cb, struct ttm_bo_device, ddestroy_cb);
+
+	schedule_delayed_work(&bdev->wq, 0);
+}
+
+/*
+ * Remove the delayed delete fence callback if it hasn't fired.
+ * Call with the lru lock held.
+ */
+static void ttm_bo_delayed_delete_disarm(struct ttm_bo_device *bdev)
+{
+	if (!bdev->ddestroy_fence)
+		return;
+
+	dma_fence_remove_callback(bdev->ddestroy_fence, &bdev->ddestroy_cb);
+	dma_fence_put(bdev->ddestroy_fence);
+	bdev->ddestroy_fence = NULL;
+}
+
+/*
+ * Have the delayed delete workqueue run again when @fence signals,
+ * rather than polling the delayed destroy list. If a callback is
+ * already pending on an earlier fence, that one is kept.
+ * Call with the lru lock held.
+ *
+ * Returns false if @fence is NULL or already signaled.
+ */
+static bool ttm_bo_delayed_delete_arm(struct ttm_bo_device *bdev,
+				      struct dma_fence *fence)
+{
+	if (bdev->ddestroy_fence) {
+		if (!dma_fence_is_signaled(bdev->ddestroy_fence))
+			return true;
+
+		ttm_bo_delayed_delete_disarm(bdev);
+	}
+
+	if (!fence || dma_fence_add_callback(fence, &bdev->ddestroy_cb,
+					     ttm_bo_delayed_delete_cb))
+		return false;
+
+	bdev->ddestroy_fence = dma_fence_get(fence);
+	return true;
+}
+
 /**
  * Traverse the delayed list, and call ttm_bo_cleanup_refs on all
  * encountered buffers.
+ *
+ * Unless @remove_all is set, busy buffers don't hold up the destruction
+ * of the buffers queued after them. Instead a callback is installed on
+ * a fence of the first busy buffer to rerun the delayed delete
+ * workqueue once it signals, and 0 is returned. A non-zero return value
+ * means that the list needs to be polled again.
  */
 
 static int ttm_bo_delayed_delete(struct ttm_bo_device *bdev, bool remove_all)
 {
 	struct ttm_bo_global *glob = bdev->glob;
 	struct ttm_buffer_object *entry = NULL;
+	struct dma_fence *fence = NULL;
+	bool busy = false;
+	bool contended = false;
 	int ret = 0;
 
 	spin_lock(&glob->lru_lock);
@@ -599,11 +682,22 @@ static int ttm_bo_delayed_delete(struct ttm_bo_device *bdev, bool remove_all)
 			spin_lock(&glob->lru_lock);
 		}
 
-		if (!ret)
+		if (!ret) {
+			if (!remove_all && !fence)
+				fence = ttm_bo_busy_fence(entry);
 			ret = ttm_bo_cleanup_refs_and_unlock(entry, false,
 							     !remove_all);
-		else
+			if (ret == -EBUSY && !remove_all) {
+				busy = true;
+				ret = 0;
+			}
+		} else {
 			spin_unlock(&glob->lru_lock);
+			if (!remove_all) {
+				contended = true;
+				ret = 0;
+			}
+		}
 
 		kref_put(&entry->list_kref, ttm_bo_release_list);
 		entry = nentry;
@@ -621,6 +715,20 @@ out_unlock:
 out:
 	if (entry)
 		kref_put(&entry->list_kref, ttm_bo_release_list);
+
+	if (busy) {
+		spin_lock(&glob->lru_lock);
+		if (!ttm_bo_delayed_delete_arm(bdev, fence))
+			ret = -EBUSY;
+		spin_unlock(&glob->lru_lock);
+	}
+	if (fence)
+		dma_fence_put(fence);
+
+	/* Buffers reserved by someone else are retried by polling. */
+	if (contended && !ret)
+		ret = -EBUSY;
+
 	return ret;
 }
 
@@ -1180,6 +1288,8 @@ int ttm_bo_init(struct ttm_bo_device *bdev,
 	bo->mem.bus.io_reserved_vm = false;
 	bo->mem.bus.io_reserved_count = 0;
 	bo->moving = NULL;
+	bo->fault_next = 0;
+	bo->fault_window = 0;
 	bo->mem.placement = (TTM_PL_FLAG_SYSTEM | TTM_PL_FLAG_CACHED);
 	bo->persistent_swap_storage = persistent_swap_storage;
 	bo->acc_size = acc_size;
@@ -1505,6 +1615,11 @@ int ttm_bo_device_release(struct ttm_bo_device *bdev)
 	list_del(&bdev->device_list);
 	mutex_unlock(&glob->device_list_mutex);
 
+	cancel_delayed_work_sync(&bdev->wq);
+	spin_lock(&glob->lru_lock);
+	ttm_bo_delayed_delete_disarm(bdev);
+	spin_unlock(&glob->lru_lock);
+	/* The fence callback may have fired and requeued the work. */
 	cancel_delayed_work_sync(&bdev->wq);
 
 	while (ttm_bo_delayed_delete(bdev, true))
@@ -1549,6 +1664,7 @@ int ttm_bo_device_init(struct ttm_bo_device *bdev,
 				    0x10000000);
 	INIT_DELAYED_WORK(&bdev->wq, ttm_bo_delayed_workqueue);
 	INIT_LIST_HEAD(&bdev->ddestroy);
+	bdev->ddestroy_fence = NULL;
 	bdev->dev_mapping = mapping;
 	bdev->glob = glob;
 	bdev->need_dma32 = need_dma32;
@@ -159,6 +159,8 @@ struct ttm_tt;
  * @swap: List head for swap LRU list.
  * @moving: Fence set when BO is moving
  * @vma_node: Address space manager node.
+ * @fault_next: Page offset following the last CPU fault prefault window.
+ * @fault_window: Number of pages to prefault on the next CPU fault.
  * @offset: The current GPU offset, which can have different meanings
  * depending on the memory type. For SYSTEM type memory, it should be 0.
  * @cur_placement: Hint of current placement.
@@ -227,6 +229,9 @@ struct ttm_buffer_object {
 
 	struct drm_vma_offset_node vma_node;
 
+	unsigned long fault_next;
+	unsigned int fault_window;
+
 	/**
 	 * Special members that are protected by the reserve lock
 	 * and the bo::lock when written to. Can be read with
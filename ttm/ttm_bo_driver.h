@@ -119,6 +119,8 @@ enum ttm_caching_state {
  * @swap_storage: Pointer to shmem struct file for swap storage.
  * @caching_state: The current caching state of the pages.
  * @state: The current binding state of the pages.
+ * @node: NUMA node of the task that created the ttm. New pages are
+ * preferably allocated on this node.
  *
  * This is a structure holding the pages, caching- and aperture binding
  * status for a buffer object that isn't backed by fixed (VRAM / AGP)
@@ -141,6 +143,7 @@ struct ttm_tt {
 		tt_unbound,
 		tt_unpopulated,
 	} state;
+	int node;
 };
 
 /**
@@ -163,6 +166,7 @@ struct ttm_dma_tt {
 #define TTM_MEMTYPE_FLAG_FIXED         (1 << 0)	/* Fixed (on-card) PCI memory */
 #define TTM_MEMTYPE_FLAG_MAPPABLE      (1 << 1)	/* Memory mappable */
 #define TTM_MEMTYPE_FLAG_CMA           (1 << 3)	/* Can't map aperture */
+#define TTM_MEMTYPE_FLAG_ORDERED_UNBIND (1 << 4) /* Unbind ordered by GPU */
 
 struct ttm_mem_type_manager;
 
@@ -548,6 +552,9 @@ struct ttm_bo_global {
  * @dev_mapping: A pointer to the struct address_space representing the
  * device address space.
  * @wq: Work queue structure for the delayed delete workqueue.
+ * @ddestroy_fence: Fence that kicks the delayed delete workqueue when
+ * signaled.
+ * @ddestroy_cb: Callback installed on @ddestroy_fence.
  *
  */
 
@@ -570,6 +577,8 @@ struct ttm_bo_device {
 	 * Protected by the global:lru lock.
 	 */
 	struct list_head ddestroy;
+	struct dma_fence *ddestroy_fence;
+	struct dma_fence_cb ddestroy_cb;
 
 	/*
 	 * Protected by load / firstopen / lastclose /unload sync.
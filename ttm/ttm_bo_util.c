@@ -64,15 +64,26 @@ int ttm_bo_move_ttm(struct ttm_buffer_object *bo,
 {
 	struct ttm_tt *ttm = bo->ttm;
 	struct ttm_mem_reg *old_mem = &bo->mem;
+	struct ttm_mem_type_manager *old_man =
+		&bo->bdev->man[old_mem->mem_type];
 	int ret;
 
 	if (old_mem->mem_type != TTM_PL_SYSTEM) {
-		ret = ttm_bo_wait(bo, interruptible, no_wait_gpu);
-
-		if (unlikely(ret != 0)) {
-			if (ret != -ERESTARTSYS)
-				pr_err("Failed to expire sync object before unbinding TTM\n");
-			return ret;
+		/*
+		 * If the unbind is executed by the GPU after all work
+		 * already queued, there's no need to wait for idle here.
+		 * The pages stay with the bo and the bo fences stay in
+		 * its reservation object, so anyone freeing or reusing
+		 * the pages will still wait for them.
+		 */
+		if (!(old_man->flags & TTM_MEMTYPE_FLAG_ORDERED_UNBIND)) {
+			ret = ttm_bo_wait(bo, interruptible, no_wait_gpu);
+
+			if (unlikely(ret != 0)) {
+				if (ret != -ERESTARTSYS)
+					pr_err("Failed to expire sync object before unbinding TTM\n");
+				return ret;
+			}
 		}
 
 		ttm_tt_unbind(ttm);
@@ -53,6 +53,7 @@
 #endif
 
 #define TTM_BO_VM_NUM_PREFAULT 16
+#define TTM_BO_VM_MAX_PREFAULT (PMD_SIZE >> PAGE_SHIFT)
 
 static int ttm_bo_vm_fault_idle(struct ttm_buffer_object *bo,
 				struct vm_area_struct *vma,
@@ -121,6 +122,7 @@ static int ttm_bo_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	unsigned long pfn;
 	struct ttm_tt *ttm = NULL;
 	struct page *page;
+	unsigned int num_prefault;
 	int ret;
 	int i;
 #if (KERNEL_VERSION(4, 10, 0) <= LINUX_VERSION_CODE)
@@ -248,11 +250,24 @@ static int ttm_bo_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 		}
 	}
 
+	/*
+	 * Grow the prefault window while the buffer is faulted in
+	 * sequentially, so that streaming through a large mapping takes
+	 * a handful of faults rather than one per TTM_BO_VM_NUM_PREFAULT
+	 * pages. Any other access pattern falls back to the default.
+	 */
+	if (page_offset == bo->fault_next && bo->fault_window)
+		num_prefault = min_t(unsigned int, bo->fault_window * 2,
+				     TTM_BO_VM_MAX_PREFAULT);
+	else
+		num_prefault = TTM_BO_VM_NUM_PREFAULT;
+	bo->fault_window = num_prefault;
+
 	/*
 	 * Speculatively prefault a number of pages. Only error on
 	 * first page.
 	 */
-	for (i = 0; i < TTM_BO_VM_NUM_PREFAULT; ++i) {
+	for (i = 0; i < num_prefault; ++i) {
 		if (bo->mem.bus.is_iomem)
 			pfn = ((bo->mem.bus.base + bo->mem.bus.offset) >> PAGE_SHIFT) + page_offset;
 		else {
@@ -292,6 +307,7 @@ static int ttm_bo_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 		if (unlikely(++page_offset >= page_last))
 			break;
 	}
+	bo->fault_next = page_offset;
 out_io_unlock:
 	ttm_mem_io_unlock(man);
 out_unlock:
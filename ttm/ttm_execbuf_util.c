@@ -62,6 +62,26 @@ static void ttm_eu_del_from_lru_locked(struct list_head *list)
 	}
 }
 
+/*
+ * Put all buffers back on their LRU lists in a single lru_lock critical
+ * section, and unreserve them after dropping the lock. Other users of
+ * the lru_lock only trylock buffers found on the LRU lists, so they will
+ * just skip buffers that are still reserved.
+ */
+static void ttm_eu_add_to_lru_and_unreserve(struct ttm_bo_global *glob,
+					    struct list_head *list)
+{
+	struct ttm_validate_buffer *entry;
+
+	spin_lock(&glob->lru_lock);
+	list_for_each_entry(entry, list, head)
+		ttm_bo_add_to_lru(entry->bo);
+	spin_unlock(&glob->lru_lock);
+
+	list_for_each_entry(entry, list, head)
+		__ttm_bo_unreserve(entry->bo);
+}
+
 void ttm_eu_backoff_reservation(struct ww_acquire_ctx *ticket,
 				struct list_head *list)
 {
@@ -74,14 +94,7 @@ void ttm_eu_backoff_reservation(struct ww_acquire_ctx *ticket,
 	entry = list_first_entry(list, struct ttm_validate_buffer, head);
 	glob = entry->bo->glob;
 
-	spin_lock(&glob->lru_lock);
-	list_for_each_entry(entry, list, head) {
-		struct ttm_buffer_object *bo = entry->bo;
-
-		ttm_bo_add_to_lru(bo);
-		__ttm_bo_unreserve(bo);
-	}
-	spin_unlock(&glob->lru_lock);
+	ttm_eu_add_to_lru_and_unreserve(glob, list);
 
 	if (ticket)
 		ww_acquire_fini(ticket);
@@ -204,18 +217,16 @@ void ttm_eu_fence_buffer_objects(struct ww_acquire_ctx *ticket,
 	driver = bdev->driver;
 	glob = bo->glob;
 
-	spin_lock(&glob->lru_lock);
-
+	/* The buffers are reserved, so fencing needs no lru_lock. */
 	list_for_each_entry(entry, list, head) {
 		bo = entry->bo;
 		if (entry->shared)
 			reservation_object_add_shared_fence(bo->resv, fence);
 		else
 			reservation_object_add_excl_fence(bo->resv, fence);
-		ttm_bo_add_to_lru(bo);
-		__ttm_bo_unreserve(bo);
 	}
-	spin_unlock(&glob->lru_lock);
+
+	ttm_eu_add_to_lru_and_unreserve(glob, list);
 	if (ticket)
 		ww_acquire_fini(ticket);
 }
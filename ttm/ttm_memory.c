@@ -37,6 +37,7 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
 #else
 #include "vmwgfx_compat.h"
 #include "ttm/ttm_memory.h"
@@ -48,6 +49,7 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
 #endif
 
 #define TTM_MEMORY_ALLOC_RETRIES 4
@@ -60,6 +62,7 @@ struct ttm_mem_zone {
 	uint64_t emer_mem;
 	uint64_t max_mem;
 	uint64_t swap_limit;
+	uint64_t swap_low;
 	uint64_t used_mem;
 };
 
@@ -79,6 +82,10 @@ static struct attribute ttm_mem_swap = {
 	.name = "swap_limit",
 	.mode = S_IRUGO | S_IWUSR
 };
+static struct attribute ttm_mem_swap_low = {
+	.name = "swap_low_limit",
+	.mode = S_IRUGO | S_IWUSR
+};
 static struct attribute ttm_mem_used = {
 	.name = "used_memory",
 	.mode = S_IRUGO
@@ -111,6 +118,8 @@ static ssize_t ttm_mem_zone_show(struct kobject *kobj,
 		val = zone->max_mem;
 	else if (attr == &ttm_mem_swap)
 		val = zone->swap_limit;
+	else if (attr == &ttm_mem_swap_low)
+		val = zone->swap_low;
 	else if (attr == &ttm_mem_used)
 		val = zone->used_mem;
 	spin_unlock(&zone->glob->lock);
@@ -150,8 +159,15 @@ static ssize_t ttm_mem_zone_store(struct kobject *kobj,
 		zone->max_mem = val64;
 		if (zone->emer_mem < val64)
 			zone->emer_mem = val64;
-	} else if (attr == &ttm_mem_swap)
+	} else if (attr == &ttm_mem_swap) {
 		zone->swap_limit = val64;
+		if (zone->swap_low > val64)
+			zone->swap_low = val64;
+	} else if (attr == &ttm_mem_swap_low) {
+		zone->swap_low = val64;
+		if (zone->swap_limit < val64)
+			zone->swap_limit = val64;
+	}
 	spin_unlock(&zone->glob->lock);
 
 	ttm_check_swapping(zone->glob);
@@ -164,6 +180,7 @@ static struct attribute *ttm_mem_zone_attrs[] = {
 	&ttm_mem_emer,
 	&ttm_mem_max,
 	&ttm_mem_swap,
+	&ttm_mem_swap_low,
 	&ttm_mem_used,
 	NULL
 };
@@ -187,8 +204,55 @@ static void ttm_mem_global_kobj_release(struct kobject *kobj)
 	kfree(glob);
 }
 
+static struct attribute ttm_mem_swapout_async = {
+	.name = "swapout_async",
+	.mode = S_IRUGO
+};
+static struct attribute ttm_mem_swapout_direct = {
+	.name = "swapout_direct",
+	.mode = S_IRUGO
+};
+static struct attribute ttm_mem_swapout_direct_us = {
+	.name = "swapout_direct_us",
+	.mode = S_IRUGO
+};
+
+static ssize_t ttm_mem_global_show(struct kobject *kobj,
+				   struct attribute *attr,
+				   char *buffer)
+{
+	struct ttm_mem_global *glob =
+		container_of(kobj, struct ttm_mem_global, kobj);
+	uint64_t val = 0;
+
+	spin_lock(&glob->lock);
+	if (attr == &ttm_mem_swapout_async)
+		val = glob->swapout_async;
+	else if (attr == &ttm_mem_swapout_direct)
+		val = glob->swapout_direct;
+	else if (attr == &ttm_mem_swapout_direct_us)
+		val = glob->swapout_direct_us;
+	spin_unlock(&glob->lock);
+
+	return snprintf(buffer, PAGE_SIZE, "%llu\n",
+			(unsigned long long) val);
+}
+
+static struct attribute *ttm_mem_glob_attrs[] = {
+	&ttm_mem_swapout_async,
+	&ttm_mem_swapout_direct,
+	&ttm_mem_swapout_direct_us,
+	NULL
+};
+
+static const struct sysfs_ops ttm_mem_glob_ops = {
+	.show = &ttm_mem_global_show,
+};
+
 static struct kobj_type ttm_mem_glob_kobj_type = {
 	.release = &ttm_mem_global_kobj_release,
+	.sysfs_ops = &ttm_mem_glob_ops,
+	.default_attrs = ttm_mem_glob_attrs,
 };
 
 static bool ttm_zones_above_swap_target(struct ttm_mem_global *glob,
@@ -202,7 +266,7 @@ static bool ttm_zones_above_swap_target(struct ttm_mem_global *glob,
 		zone = glob->zones[i];
 
 		if (from_wq)
-			target = zone->swap_limit;
+			target = zone->swap_low;
 		else if (capable(CAP_SYS_ADMIN))
 			target = zone->emer_mem;
 		else
@@ -221,6 +285,10 @@ static bool ttm_zones_above_swap_target(struct ttm_mem_global *glob,
  * Extend this if needed, perhaps using a linked list of callbacks.
  * Note that this function is reentrant:
  * many threads may try to swap out at any given time.
+ *
+ * The swap worker is kicked when a zone crosses its swap_limit and then
+ * keeps swapping until all zones are below swap_low, so that it stays
+ * ahead of allocating threads rather than trailing them page by page.
  */
 
 static void ttm_shrink(struct ttm_mem_global *glob, bool from_wq,
@@ -228,6 +296,7 @@ static void ttm_shrink(struct ttm_mem_global *glob, bool from_wq,
 {
 	int ret;
 	struct ttm_mem_shrink *shrink;
+	ktime_t start = ktime_get();
 
 	spin_lock(&glob->lock);
 	if (glob->shrink == NULL)
@@ -240,8 +309,15 @@ static void ttm_shrink(struct ttm_mem_global *glob, bool from_wq,
 		spin_lock(&glob->lock);
 		if (unlikely(ret != 0))
 			goto out;
+		if (from_wq)
+			glob->swapout_async++;
+		else
+			glob->swapout_direct++;
 	}
 out:
+	if (!from_wq)
+		glob->swapout_direct_us +=
+			ktime_to_us(ktime_sub(ktime_get(), start));
 	spin_unlock(&glob->lock);
 }
 
@@ -273,6 +349,7 @@ static int ttm_mem_init_kernel_zone(struct ttm_mem_global *glob,
 	zone->max_mem = mem >> 1;
 	zone->emer_mem = (mem >> 1) + (mem >> 2);
 	zone->swap_limit = zone->max_mem - (mem >> 3);
+	zone->swap_low = zone->swap_limit - (mem >> 4);
 	zone->used_mem = 0;
 	zone->glob = glob;
 	glob->zone_kernel = zone;
@@ -309,6 +386,7 @@ static int ttm_mem_init_highmem_zone(struct ttm_mem_global *glob,
 	zone->max_mem = mem >> 1;
 	zone->emer_mem = (mem >> 1) + (mem >> 2);
 	zone->swap_limit = zone->max_mem - (mem >> 3);
+	zone->swap_low = zone->swap_limit - (mem >> 4);
 	zone->used_mem = 0;
 	zone->glob = glob;
 	glob->zone_highmem = zone;
@@ -357,6 +435,7 @@ static int ttm_mem_init_dma32_zone(struct ttm_mem_global *glob,
 	zone->max_mem = mem >> 1;
 	zone->emer_mem = (mem >> 1) + (mem >> 2);
 	zone->swap_limit = zone->max_mem - (mem >> 3);
+	zone->swap_low = zone->swap_limit - (mem >> 4);
 	zone->used_mem = 0;
 	zone->glob = glob;
 	glob->zone_dma32 = zone;
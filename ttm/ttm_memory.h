@@ -67,6 +67,11 @@ struct ttm_mem_shrink {
  * @zone_kernel: Pointer to the kernel zone.
  * @zone_highmem: Pointer to the highmem zone if there is one.
  * @zone_dma32: Pointer to the dma32 zone if there is one.
+ * @swapout_async: Number of buffer objects swapped out by the swap worker.
+ * @swapout_direct: Number of buffer objects swapped out by allocating
+ * threads.
+ * @swapout_direct_us: Total time allocating threads spent swapping out,
+ * in microseconds.
  *
  * Note that this structure is not per device. It should be global for all
  * graphics devices.
@@ -88,6 +93,9 @@ struct ttm_mem_global {
 #else
 	struct ttm_mem_zone *zone_dma32;
 #endif
+	uint64_t swapout_async;
+	uint64_t swapout_direct;
+	uint64_t swapout_direct_us;
 };
 
 /**
@@ -519,7 +519,8 @@ static void ttm_handle_caching_state_failure(struct list_head *pages,
  * pages returned in pages array.
  */
 static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
-		int ttm_flags, enum ttm_caching_state cstate, unsigned count)
+		int ttm_flags, enum ttm_caching_state cstate, unsigned count,
+		int node)
 {
 	struct page **caching_array;
 	struct page *p;
@@ -537,7 +538,7 @@ static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
 	}
 
 	for (i = 0, cpages = 0; i < count; ++i) {
-		p = alloc_page(gfp_flags);
+		p = alloc_pages_node(node, gfp_flags, 0);
 
 		if (!p) {
 			pr_err("Unable to get page %u\n", i);
@@ -630,7 +631,7 @@ static void ttm_page_pool_fill_locked(struct ttm_page_pool *pool,
 
 		INIT_LIST_HEAD(&new_pages);
 		r = ttm_alloc_new_pages(&new_pages, pool->gfp_flags, ttm_flags,
-				cstate,	alloc_size);
+				cstate,	alloc_size, NUMA_NO_NODE);
 		spin_lock_irqsave(&pool->lock, *irq_flags);
 
 		if (!r) {
@@ -747,10 +748,11 @@ static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 
 /*
  * On success pages list will hold count number of correctly
- * cached pages.
+ * cached pages. Pages that need to be newly allocated are preferably
+ * allocated on @node.
  */
 static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
-			 enum ttm_caching_state cstate)
+			 enum ttm_caching_state cstate, int node)
 {
 	struct ttm_page_pool *pool = ttm_get_pool(flags, cstate);
 	struct list_head plist;
@@ -770,8 +772,27 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 		else
 			gfp_flags |= GFP_HIGHUSER;
 
-		for (r = 0; r < npages; ++r) {
-			p = alloc_page(gfp_flags);
+		r = 0;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		/*
+		 * Try to hand out physically contiguous runs of pages so
+		 * that the device mappings of large buffers coalesce.
+		 */
+		while (npages - r >= HPAGE_PMD_NR) {
+			unsigned i;
+
+			p = alloc_pages_node(node, gfp_flags | __GFP_NORETRY |
+					     __GFP_NOWARN, HPAGE_PMD_ORDER);
+			if (!p)
+				break;
+
+			split_page(p, HPAGE_PMD_ORDER);
+			for (i = 0; i < HPAGE_PMD_NR; ++i)
+				pages[r++] = p + i;
+		}
+#endif
+		for (; r < npages; ++r) {
+			p = alloc_pages_node(node, gfp_flags, 0);
 			if (!p) {
 
 				pr_err("Unable to allocate page\n");
@@ -810,7 +831,8 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 		 * multiple requests in parallel.
 		 **/
 		INIT_LIST_HEAD(&plist);
-		r = ttm_alloc_new_pages(&plist, gfp_flags, flags, cstate, npages);
+		r = ttm_alloc_new_pages(&plist, gfp_flags, flags, cstate, npages,
+					node);
 		list_for_each_entry(p, &plist, lru) {
 			pages[count++] = p;
 		}
@@ -889,29 +911,59 @@ void ttm_page_alloc_fini(void)
 	_manager = NULL;
 }
 
+/*
+ * Release the first @mem_count_update pages from the memory accounting
+ * and hand all pages of @ttm back to the pool in a single batch.
+ */
+static void ttm_pool_unpopulate_helper(struct ttm_tt *ttm,
+				       unsigned mem_count_update)
+{
+	unsigned i;
+
+	for (i = 0; i < mem_count_update; ++i) {
+		if (!ttm->pages[i])
+			continue;
+
+		ttm_mem_global_free_page(ttm->glob->mem_glob, ttm->pages[i]);
+	}
+
+	ttm_put_pages(ttm->pages, ttm->num_pages, ttm->page_flags,
+		      ttm->caching_state);
+	ttm->state = tt_unpopulated;
+}
+
 int ttm_pool_populate(struct ttm_tt *ttm)
 {
 	struct ttm_mem_global *mem_glob = ttm->glob->mem_glob;
-	unsigned i;
+	unsigned i, j, count;
 	int ret;
 
 	if (ttm->state != tt_unpopulated)
 		return 0;
 
-	for (i = 0; i < ttm->num_pages; ++i) {
-		ret = ttm_get_pages(&ttm->pages[i], 1,
-				    ttm->page_flags,
-				    ttm->caching_state);
-		if (ret != 0) {
-			ttm_pool_unpopulate(ttm);
+	/*
+	 * Grab pages in batches, so that the pool lock is taken once per
+	 * batch and caching changes of new pages are batched, while no more
+	 * than one batch is ever allocated ahead of the memory accounting.
+	 */
+	for (i = 0; i < ttm->num_pages; i += count) {
+		count = min_t(unsigned, ttm->num_pages - i,
+			      NUM_PAGES_TO_ALLOC);
+		ret = ttm_get_pages(&ttm->pages[i], count, ttm->page_flags,
+				    ttm->caching_state, ttm->node);
+		if (unlikely(ret != 0)) {
+			ttm_pool_unpopulate_helper(ttm, i);
 			return -ENOMEM;
 		}
 
-		ret = ttm_mem_global_alloc_page(mem_glob, ttm->pages[i],
-						false, false);
-		if (unlikely(ret != 0)) {
-			ttm_pool_unpopulate(ttm);
-			return -ENOMEM;
+		for (j = i; j < i + count; ++j) {
+			ret = ttm_mem_global_alloc_page(mem_glob,
+							ttm->pages[j],
+							false, false);
+			if (unlikely(ret != 0)) {
+				ttm_pool_unpopulate_helper(ttm, j);
+				return -ENOMEM;
+			}
 		}
 	}
 
@@ -930,18 +982,7 @@ EXPORT_SYMBOL(ttm_pool_populate);
 
 void ttm_pool_unpopulate(struct ttm_tt *ttm)
 {
-	unsigned i;
-
-	for (i = 0; i < ttm->num_pages; ++i) {
-		if (ttm->pages[i]) {
-			ttm_mem_global_free_page(ttm->glob->mem_glob,
-						 ttm->pages[i]);
-			ttm_put_pages(&ttm->pages[i], 1,
-				      ttm->page_flags,
-				      ttm->caching_state);
-		}
-	}
-	ttm->state = tt_unpopulated;
+	ttm_pool_unpopulate_helper(ttm, ttm->num_pages);
 }
 EXPORT_SYMBOL(ttm_pool_unpopulate);
 
@@ -963,6 +1004,30 @@ int ttm_page_alloc_debugfs(struct seq_file *m, void *data)
 				p->name, p->nrefills,
 				p->nfrees, p->npages);
 	}
+
+	if (num_online_nodes() > 1) {
+		struct page *page;
+		unsigned long irq_flags;
+		unsigned count;
+		int nid;
+
+		seq_printf(m, "\n%6s %6s %8s\n", h[0], "node", h[3]);
+		for (i = 0; i < NUM_POOLS; ++i) {
+			p = &_manager->pools[i];
+
+			for_each_online_node(nid) {
+				count = 0;
+				spin_lock_irqsave(&p->lock, irq_flags);
+				list_for_each_entry(page, &p->list, lru)
+					if (page_to_nid(page) == nid)
+						++count;
+				spin_unlock_irqrestore(&p->lock, irq_flags);
+
+				seq_printf(m, "%6s %6d %8u\n",
+					   p->name, nid, count);
+			}
+		}
+	}
 	return 0;
 }
 EXPORT_SYMBOL(ttm_page_alloc_debugfs);
@@ -30,6 +30,8 @@
 /*
  * Template that implements find_first_diff() for a generic
  * unsigned integer type. @size and return value are in bytes.
+ * Unchanged content is the common case, so compare four items at a time
+ * with a single branch before narrowing down.
  */
 #define VMW_FIND_FIRST_DIFF(_type)			 \
 static size_t vmw_find_first_diff_ ## _type		 \
@@ -37,7 +39,16 @@ static size_t vmw_find_first_diff_ ## _type		 \
 {							 \
 	size_t i;					 \
 							 \
-	for (i = 0; i < size; i += sizeof(_type)) {	 \
+	for (i = 0; i + 4 * sizeof(_type) <= size;	 \
+	     i += 4 * sizeof(_type)) {			 \
+		if ((dst[0] ^ src[0]) | (dst[1] ^ src[1]) |\
+		    (dst[2] ^ src[2]) | (dst[3] ^ src[3])) \
+			break;				 \
+		dst += 4;				 \
+		src += 4;				 \
+	}						 \
+							 \
+	for (; i < size; i += sizeof(_type)) {		 \
 		if (*dst++ != *src++)			 \
 			break;				 \
 	}						 \
@@ -46,26 +57,6 @@ static size_t vmw_find_first_diff_ ## _type		 \
 }
 
 
-/*
- * Template that implements find_last_diff() for a generic
- * unsigned integer type. Pointers point to the item following the
- * *end* of the area to be examined. @size and return value are in
- * bytes.
- */
-#define VMW_FIND_LAST_DIFF(_type)					\
-static ssize_t vmw_find_last_diff_ ## _type(				\
-	const _type * dst, const _type * src, size_t size)		\
-{									\
-	while (size) {							\
-		if (*--dst != *--src)					\
-			break;						\
-									\
-		size -= sizeof(_type);					\
-	}								\
-	return size;							\
-}
-
-
 /*
  * Instantiate find diff functions for relevant unsigned integer sizes,
  * assuming that wider integers are faster (including aligning) up to the
@@ -73,17 +64,11 @@ static ssize_t vmw_find_last_diff_ ## _type(				\
  * CONFIG_64BIT is defined.
  */
 VMW_FIND_FIRST_DIFF(u8);
-VMW_FIND_LAST_DIFF(u8);
-
 VMW_FIND_FIRST_DIFF(u16);
-VMW_FIND_LAST_DIFF(u16);
-
 VMW_FIND_FIRST_DIFF(u32);
-VMW_FIND_LAST_DIFF(u32);
 
 #ifdef CONFIG_64BIT
 VMW_FIND_FIRST_DIFF(u64);
-VMW_FIND_LAST_DIFF(u64);
 #endif
 
 
@@ -164,111 +149,148 @@ static size_t vmw_find_first_diff(const u8 *dst, const u8 *src, size_t size,
 }
 
 
-/*
- * Template to compute find_last_diff() for a certain integer type
- * including a tail copy for alignment, and adjustment of parameters
- * for head find or increased resolution find using an unsigned integer find
- * of smaller width. If finding is complete, and resolution is sufficient,
- * the macro executes a return statement. Otherwise it falls through.
+/**
+ * vmw_memcpy - A wrapper around kernel memcpy with allowing to plug it into a
+ * struct vmw_diff_cpy.
+ *
+ * @diff: The struct vmw_diff_cpy closure argument (unused).
+ * @dest: The copy destination.
+ * @src: The copy source.
+ * @n: Number of bytes to copy.
  */
-#define VMW_TRY_FIND_LAST_DIFF(_type)					\
-do {									\
-	unsigned int spill = SPILL(dst, _type);				\
-	ssize_t location;						\
-	ssize_t diff_offs;						\
-									\
-	if (spill && spill <= size && spill == SPILL(src, _type)) {	\
-		diff_offs = vmw_find_last_diff_u8(dst, src, spill);	\
-		if (diff_offs) {					\
-			location = size - spill + diff_offs - 1;	\
-			return round_down(location, granularity);	\
-		}							\
-									\
-		dst -= spill;						\
-		src -= spill;						\
-		size -= spill;						\
-		spill = 0;						\
-	}								\
-	if (!spill && !SPILL(src, _type)) {				\
-		size_t to_copy = round_down(size, sizeof(_type));	\
-									\
-		diff_offs = vmw_find_last_diff_ ## _type		\
-			((_type *) dst, (_type *) src, to_copy);	\
-		location = size - to_copy + diff_offs - sizeof(_type);	\
-		if (location < 0 || granularity == sizeof(_type))	\
-			return location;				\
-									\
-		dst -= to_copy - diff_offs;				\
-		src -= to_copy - diff_offs;				\
-		size -= to_copy - diff_offs;				\
-	}								\
-} while (0)
+void vmw_memcpy(struct vmw_diff_cpy *diff, u8 *dest, const u8 *src, size_t n)
+{
+	memcpy(dest, src, n);
+}
 
 
 /**
- * vmw_find_last_diff - find the last difference between dst and src
+ * vmw_rect_union - Grow a rectangle to also cover another rectangle
  *
- * @dst: The destination address
- * @src: The source address
- * @size: Number of bytes to compare
- * @granularity: The granularity needed for the return value in bytes.
- * return: The offset from find start where the last difference was
- * encountered in bytes, or a negative value if no difference was found.
+ * @rect: The rectangle to grow.
+ * @other: The rectangle to cover.
  */
-static ssize_t vmw_find_last_diff(const u8 *dst, const u8 *src, size_t size,
-				  size_t granularity)
+static void vmw_rect_union(struct drm_rect *rect, const struct drm_rect *other)
 {
-	dst += size;
-	src += size;
+	rect->x1 = min(rect->x1, other->x1);
+	rect->y1 = min(rect->y1, other->y1);
+	rect->x2 = max(rect->x2, other->x2);
+	rect->y2 = max(rect->y2, other->y2);
+}
 
-#ifdef CONFIG_64BIT
-	VMW_TRY_FIND_LAST_DIFF(u64);
-#endif
-	VMW_TRY_FIND_LAST_DIFF(u32);
-	VMW_TRY_FIND_LAST_DIFF(u16);
+/**
+ * vmw_rect_union_growth - Compute the area added by a rectangle union
+ *
+ * @rect: The rectangle to grow.
+ * @other: The rectangle to cover.
+ * return: The area of the union of @rect and @other minus the area of @rect.
+ */
+static s64 vmw_rect_union_growth(const struct drm_rect *rect,
+				 const struct drm_rect *other)
+{
+	struct drm_rect tmp = *rect;
 
-	return round_down(vmw_find_last_diff_u8(dst, src, size) - 1,
-			  granularity);
-}
+	vmw_rect_union(&tmp, other);
 
+	return (s64) drm_rect_width(&tmp) * drm_rect_height(&tmp) -
+		(s64) drm_rect_width(rect) * drm_rect_height(rect);
+}
 
 /**
- * vmw_memcpy - A wrapper around kernel memcpy with allowing to plug it into a
- * struct vmw_diff_cpy.
+ * vmw_diff_add_span - Add a modified line span to the output rectangles
  *
- * @diff: The struct vmw_diff_cpy closure argument (unused).
- * @dest: The copy destination.
- * @src: The copy source.
- * @n: Number of bytes to copy.
+ * @diff: The struct vmw_diff_cpy used to track modified content. The span
+ * starts at @diff->line_offset.
+ * @len: The length of the span in bytes.
+ *
+ * Lines are processed top to bottom, so a span is merged into a rectangle
+ * reaching down to the current line if they touch horizontally. Otherwise
+ * it starts a new rectangle, or, if all rectangles are in use, it is merged
+ * into the rectangle whose area grows the least.
  */
-void vmw_memcpy(struct vmw_diff_cpy *diff, u8 *dest, const u8 *src, size_t n)
+static void vmw_diff_add_span(struct vmw_diff_cpy *diff, size_t len)
 {
-	memcpy(dest, src, n);
+	struct drm_rect span, *rect;
+	s64 growth, best_growth = S64_MAX;
+	unsigned int i, best = 0;
+
+	span.x1 = diff->line_offset / diff->cpp;
+	span.x2 = span.x1 + len / diff->cpp;
+	span.y1 = diff->line;
+	span.y2 = diff->line + 1;
+
+	diff->modified += len / diff->cpp;
+	vmw_rect_union(&diff->rect, &span);
+
+	for (i = 0; i < diff->num_rects; ++i) {
+		rect = &diff->rects[i];
+		if (rect->y2 >= span.y1 && rect->x1 <= span.x2 &&
+		    span.x1 <= rect->x2) {
+			vmw_rect_union(rect, &span);
+			return;
+		}
+	}
+
+	if (diff->num_rects < VMW_DIFF_MAX_RECTS) {
+		diff->rects[diff->num_rects++] = span;
+		return;
+	}
+
+	for (i = 0; i < diff->num_rects; ++i) {
+		growth = vmw_rect_union_growth(&diff->rects[i], &span);
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+
+	vmw_rect_union(&diff->rects[best], &span);
 }
 
+/*
+ * Unchanged runs shorter than this many bytes within a modified span are
+ * copied rather than splitting the span, since the extra compare and
+ * memcpy setup would cost more than the copy itself.
+ */
+#define VMW_DIFF_MIN_GAP 64
 
 /**
- * vmw_adjust_rect - Adjust rectangle coordinates for newly found difference
+ * vmw_find_span_end - find the end of a span of modified content
  *
- * @diff: The struct vmw_diff_cpy used to track the modified bounding box.
- * @diff_offs: The offset from @diff->line_offset where the difference was
- * found.
+ * @dst: The destination address. The first @granularity bytes are
+ * assumed to differ.
+ * @src: The source address
+ * @size: Number of bytes to examine
+ * @granularity: The granularity needed for the return value in bytes.
+ * return: The length of the span in bytes. The span ends with its last
+ * modified unit before at least VMW_DIFF_MIN_GAP unchanged bytes, or before
+ * the end of the examined area.
  */
-static void vmw_adjust_rect(struct vmw_diff_cpy *diff, size_t diff_offs)
+static size_t vmw_find_span_end(const u8 *dst, const u8 *src, size_t size,
+				size_t granularity)
 {
-	size_t offs = (diff_offs + diff->line_offset) / diff->cpp;
-	struct drm_rect *rect = &diff->rect;
+	size_t gap = roundup(VMW_DIFF_MIN_GAP, granularity);
+	size_t offset = granularity;
+
+	while (offset < size) {
+		size_t chunk = min(gap, size - offset);
+		size_t diff_offs = vmw_find_first_diff(dst + offset,
+						       src + offset, chunk,
+						       granularity);
 
-	rect->x1 = min_t(int, rect->x1, offs);
-	rect->x2 = max_t(int, rect->x2, offs + 1);
-	rect->y1 = min_t(int, rect->y1, diff->line);
-	rect->y2 = max_t(int, rect->y2, diff->line + 1);
+		if (diff_offs >= chunk)
+			return offset;
+
+		offset += diff_offs + granularity;
+	}
+
+	return offset;
 }
 
 /**
- * vmw_diff_memcpy - memcpy that creates a bounding box of modified content.
+ * vmw_diff_memcpy - memcpy that tracks modified content.
  *
- * @diff: The struct vmw_diff_cpy used to track the modified bounding box.
+ * @diff: The struct vmw_diff_cpy used to track the modified content.
  * @dest: The copy destination.
  * @src: The copy source.
  * @n: Number of bytes to copy.
@@ -282,35 +304,42 @@ static void vmw_adjust_rect(struct vmw_diff_cpy *diff, size_t diff_offs)
  * This is needed to know the needed granularity of the difference computing
  * operations. A higher cpp generally leads to faster execution at the cost of
  * bounding box width precision.
+ *
+ * Only the modified spans of the line are copied. Spans separated by less
+ * than VMW_DIFF_MIN_GAP unchanged bytes are copied as one. The spans are
+ * coalesced into at most VMW_DIFF_MAX_RECTS rectangles in @diff->rects, and
+ * their bounding box is kept in @diff->rect.
  */
 void vmw_diff_memcpy(struct vmw_diff_cpy *diff, u8 *dest, const u8 *src,
 		     size_t n)
 {
-	ssize_t csize, byte_len;
+	size_t csize, span;
 
 	if (WARN_ON_ONCE(round_down(n, diff->cpp) != n))
 		return;
 
-	/* TODO: Possibly use a single vmw_find_first_diff per line? */
-	csize = vmw_find_first_diff(dest, src, n, diff->cpp);
-	if (csize < n) {
-		vmw_adjust_rect(diff, csize);
-		byte_len = diff->cpp;
+	while (n) {
+		csize = vmw_find_first_diff(dest, src, n, diff->cpp);
+		if (csize >= n)
+			break;
 
-		/*
-		 * Starting from where first difference was found, find
-		 * location of last difference, and then copy.
-		 */
 		diff->line_offset += csize;
 		dest += csize;
 		src += csize;
 		n -= csize;
-		csize = vmw_find_last_diff(dest, src, n, diff->cpp);
-		if (csize >= 0) {
-			byte_len += csize;
-			vmw_adjust_rect(diff, csize);
-		}
-		memcpy(dest, src, byte_len);
+
+		/*
+		 * Starting from where the difference was found, find the
+		 * end of the modified span, and then copy.
+		 */
+		span = vmw_find_span_end(dest, src, n, diff->cpp);
+		vmw_diff_add_span(diff, span);
+		memcpy(dest, src, span);
+
+		diff->line_offset += span;
+		dest += span;
+		src += span;
+		n -= span;
 	}
 	diff->line_offset += n;
 }
@@ -69,6 +69,12 @@
 #define DRM_VMW_CREATE_EXTENDED_CONTEXT 26
 #define DRM_VMW_GB_SURFACE_CREATE_EXT   27
 #define DRM_VMW_GB_SURFACE_REF_EXT      28
+/* guarded by DRM_VMW_PARAM_TIMELINE == 1 */
+#define DRM_VMW_TIMELINE_CREATE         29
+#define DRM_VMW_TIMELINE_UNREF          30
+#define DRM_VMW_TIMELINE_QUERY          31
+#define DRM_VMW_TIMELINE_WAIT           32
+#define DRM_VMW_TIMELINE_SIGNAL         33
 
 /*************************************************************************/
 /**
@@ -83,6 +89,21 @@
  *
  * DRM_VMW_PARAM_SM4_1
  * SM4_1 support is enabled.
+ *
+ * DRM_VMW_PARAM_TIMELINE
+ * Timeline sync objects and execbuf version 3 are supported.
+ *
+ * DRM_VMW_PARAM_REG_ACCESS_RATE
+ * Average number of device register accesses per second causing a VM exit,
+ * since the previous query.
+ *
+ * DRM_VMW_PARAM_CPU_BLIT_MODIFIED
+ * Number of pixels found modified by CPU screen target blits since load.
+ *
+ * DRM_VMW_PARAM_CPU_BLIT_TRANSFERRED
+ * Number of pixels updated on the host by CPU screen target blits since
+ * load. Compared to DRM_VMW_PARAM_CPU_BLIT_MODIFIED, this tells how much
+ * unmodified content was transferred due to rectangle coalescing.
  */
 
 #define DRM_VMW_PARAM_NUM_STREAMS      0
@@ -100,6 +121,10 @@
 #define DRM_VMW_PARAM_DX               12
 #define DRM_VMW_PARAM_HW_CAPS2         13
 #define DRM_VMW_PARAM_SM4_1            14
+#define DRM_VMW_PARAM_TIMELINE         15
+#define DRM_VMW_PARAM_REG_ACCESS_RATE  16
+#define DRM_VMW_PARAM_CPU_BLIT_MODIFIED 17
+#define DRM_VMW_PARAM_CPU_BLIT_TRANSFERRED 18
 
 /**
  * enum drm_vmw_handle_type - handle type for ref ioctls
@@ -305,14 +330,40 @@ union drm_vmw_surface_reference_arg {
  * which version it uses.
  * @flags: Execbuf flags.
  * @imported_fence_fd:  FD for a fence imported from another device
+ * @wait_timeline: Handle of a timeline to wait on before execution.
+ * Only used with DRM_VMW_EXECBUF_FLAG_TIMELINE_WAIT.
+ * @signal_timeline: Handle of a timeline to signal on completion.
+ * Only used with DRM_VMW_EXECBUF_FLAG_TIMELINE_SIGNAL.
+ * @wait_point: Timeline point of @wait_timeline to wait for. The point
+ * need not have been submitted yet (wait-before-signal).
+ * @signal_point: Timeline point of @signal_timeline that is signaled when
+ * the command buffer has executed. Must be larger than any point previously
+ * submitted on that timeline.
+ * @in_fence_fds: User-space address of an array of int32_t sync_file FDs
+ * the command buffer depends on, cast to an uint64_t.
+ * @in_fence_handles: User-space address of an array of uint32_t fence object
+ * handles the command buffer depends on, cast to an uint64_t.
+ * @num_in_fence_fds: Number of entries in @in_fence_fds.
+ * @num_in_fence_handles: Number of entries in @in_fence_handles.
+ *
+ * Starting with version 4, the ioctl never blocks on dependencies. The
+ * imported fence, the in-fences, and the wait timeline point are instead
+ * waited for in the kernel, and the command buffer is submitted to the
+ * device once they have signaled. If the submission had to be deferred,
+ * the returned @fence_rep::handle and @fence_rep::mask are zero, and
+ * completion should be tracked using the exported fence FD or the signal
+ * timeline point. Command buffers of the same client are always submitted
+ * in order.
  *
  * Argument to the DRM_VMW_EXECBUF Ioctl.
  */
 
-#define DRM_VMW_EXECBUF_VERSION 2
+#define DRM_VMW_EXECBUF_VERSION 4
 
 #define DRM_VMW_EXECBUF_FLAG_IMPORT_FENCE_FD (1 << 0)
 #define DRM_VMW_EXECBUF_FLAG_EXPORT_FENCE_FD (1 << 1)
+#define DRM_VMW_EXECBUF_FLAG_TIMELINE_WAIT   (1 << 2)
+#define DRM_VMW_EXECBUF_FLAG_TIMELINE_SIGNAL (1 << 3)
 
 struct drm_vmw_execbuf_arg {
 	uint64_t commands;
@@ -323,6 +374,14 @@ struct drm_vmw_execbuf_arg {
 	uint32_t flags;
 	uint32_t context_handle;
 	int32_t imported_fence_fd;
+	uint32_t wait_timeline;
+	uint32_t signal_timeline;
+	uint64_t wait_point;
+	uint64_t signal_point;
+	uint64_t in_fence_fds;
+	uint64_t in_fence_handles;
+	uint32_t num_in_fence_fds;
+	uint32_t num_in_fence_handles;
 };
 
 /**
@@ -446,6 +505,11 @@ union drm_vmw_alloc_bo_arg {
  *
  * Defines a rectangle. Used in the overlay ioctl to define
  * source and destination rectangle.
+ *
+ * The "damage_clips" property of primary planes is a blob holding an array
+ * of these, in framebuffer coordinates, telling which parts of the
+ * framebuffer changed since the last commit on that plane. If the property
+ * is not set for a commit, the whole plane is updated.
  */
 
 struct drm_vmw_rect {
@@ -1210,4 +1274,124 @@ union drm_vmw_gb_surface_reference_ext_arg {
 	struct drm_vmw_surface_arg req;
 };
 
+/*************************************************************************/
+/**
+ * DRM_VMW_TIMELINE_CREATE - Create a timeline sync object.
+ *
+ * A timeline is a persistent kernel object carrying a monotonically
+ * increasing 64-bit point. Command submissions attach fences to new points
+ * on the timeline and can wait on points of other timelines, without
+ * having to create a file descriptor per submission.
+ */
+
+/**
+ * struct drm_vmw_timeline_create_arg
+ *
+ * @initial_point: Point the timeline is considered signaled up to on
+ * creation.
+ * @handle: Out: Handle of the new timeline.
+ * @pad64: Unused 64-bit padding.
+ *
+ * Input / Output argument to the DRM_VMW_TIMELINE_CREATE ioctl.
+ */
+struct drm_vmw_timeline_create_arg {
+	uint64_t initial_point;
+	uint32_t handle;
+	uint32_t pad64;
+};
+
+/*************************************************************************/
+/**
+ * DRM_VMW_TIMELINE_UNREF - Unreference a timeline sync object.
+ *
+ * Takes a struct drm_vmw_handle_close_arg. The timeline is destroyed when
+ * the last reference, including references held by pending command
+ * submissions, goes away.
+ */
+
+/*************************************************************************/
+/**
+ * DRM_VMW_TIMELINE_QUERY - Query the current points of a timeline.
+ */
+
+/**
+ * struct drm_vmw_timeline_query_arg
+ *
+ * @handle: Handle of the timeline.
+ * @pad64: Unused 64-bit padding.
+ * @signaled_point: Out: All points up to and including this point have
+ * signaled.
+ * @submitted_point: Out: Highest point submitted on the timeline.
+ *
+ * Input / Output argument to the DRM_VMW_TIMELINE_QUERY ioctl.
+ */
+struct drm_vmw_timeline_query_arg {
+	uint32_t handle;
+	uint32_t pad64;
+	uint64_t signaled_point;
+	uint64_t submitted_point;
+};
+
+/*************************************************************************/
+/**
+ * DRM_VMW_TIMELINE_WAIT - Wait for a timeline point to signal.
+ */
+
+/*
+ * Wait for the point to be submitted rather than failing with -EINVAL if
+ * it has not been submitted yet.
+ */
+#define DRM_VMW_TIMELINE_WAIT_FLAG_FOR_SUBMIT (1 << 0)
+/* Return once the point has been submitted, without waiting for it. */
+#define DRM_VMW_TIMELINE_WAIT_FLAG_AVAILABLE  (1 << 1)
+
+/**
+ * struct drm_vmw_timeline_wait_arg
+ *
+ * @handle: Handle of the timeline.
+ * @flags: A set of flags as defined above.
+ * @point: The point to wait for.
+ * @timeout_us: Wait timeout in microseconds.
+ * @kernel_cookie: Set to 0 on first call. Left alone on restart.
+ * @cookie_valid: Must be reset to 0 on first call. Left alone on restart.
+ * @pad64: Unused 64-bit padding.
+ *
+ * Input argument to the DRM_VMW_TIMELINE_WAIT ioctl. Returns -EBUSY on
+ * timeout.
+ */
+struct drm_vmw_timeline_wait_arg {
+	uint32_t handle;
+	uint32_t flags;
+	uint64_t point;
+	uint64_t timeout_us;
+	uint64_t kernel_cookie;
+	int32_t cookie_valid;
+	int32_t pad64;
+};
+
+/*************************************************************************/
+/**
+ * DRM_VMW_TIMELINE_SIGNAL - Signal a timeline point from the CPU.
+ *
+ * The point becomes signaled once all previously submitted points have
+ * signaled. Typically used to release submissions that were queued
+ * waiting for a point that has not yet been submitted.
+ */
+
+/**
+ * struct drm_vmw_timeline_signal_arg
+ *
+ * @handle: Handle of the timeline.
+ * @pad64: Unused 64-bit padding.
+ * @point: The point to signal. Must be larger than any point previously
+ * submitted on the timeline.
+ *
+ * Input argument to the DRM_VMW_TIMELINE_SIGNAL ioctl.
+ */
+struct drm_vmw_timeline_signal_arg {
+	uint32_t handle;
+	uint32_t pad64;
+	uint64_t point;
+};
+
 #endif
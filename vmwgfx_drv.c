@@ -34,6 +34,7 @@
 #include "ttm/ttm_object.h"
 #include "ttm/ttm_module.h"
 #include <linux/dma_remapping.h>
+#include <linux/seq_file.h>
 #include "vmwgfx_version.h"
 
 
@@ -145,6 +146,21 @@
 #define DRM_IOCTL_VMW_GB_SURFACE_REF_EXT				\
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_VMW_GB_SURFACE_REF_EXT,		\
 		union drm_vmw_gb_surface_reference_ext_arg)
+#define DRM_IOCTL_VMW_TIMELINE_CREATE				\
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_VMW_TIMELINE_CREATE,	\
+		 struct drm_vmw_timeline_create_arg)
+#define DRM_IOCTL_VMW_TIMELINE_UNREF				\
+	DRM_IOW(DRM_COMMAND_BASE + DRM_VMW_TIMELINE_UNREF,	\
+		 struct drm_vmw_handle_close_arg)
+#define DRM_IOCTL_VMW_TIMELINE_QUERY				\
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_VMW_TIMELINE_QUERY,	\
+		 struct drm_vmw_timeline_query_arg)
+#define DRM_IOCTL_VMW_TIMELINE_WAIT				\
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_VMW_TIMELINE_WAIT,	\
+		 struct drm_vmw_timeline_wait_arg)
+#define DRM_IOCTL_VMW_TIMELINE_SIGNAL				\
+	DRM_IOW(DRM_COMMAND_BASE + DRM_VMW_TIMELINE_SIGNAL,	\
+		 struct drm_vmw_timeline_signal_arg)
 
 /**
  * The core DRM version of this macro doesn't account for
@@ -238,6 +254,21 @@ static const struct drm_ioctl_desc vmw_ioctls[] = {
 	VMW_IOCTL_DEF(VMW_GB_SURFACE_REF_EXT,
 		      vmw_gb_surface_reference_ext_ioctl,
 		      DRM_AUTH | DRM_RENDER_ALLOW),
+	VMW_IOCTL_DEF(VMW_TIMELINE_CREATE,
+		      vmw_timeline_create_ioctl,
+		      DRM_AUTH | DRM_RENDER_ALLOW),
+	VMW_IOCTL_DEF(VMW_TIMELINE_UNREF,
+		      vmw_timeline_unref_ioctl,
+		      DRM_RENDER_ALLOW),
+	VMW_IOCTL_DEF(VMW_TIMELINE_QUERY,
+		      vmw_timeline_query_ioctl,
+		      DRM_RENDER_ALLOW),
+	VMW_IOCTL_DEF(VMW_TIMELINE_WAIT,
+		      vmw_timeline_wait_ioctl,
+		      DRM_RENDER_ALLOW),
+	VMW_IOCTL_DEF(VMW_TIMELINE_SIGNAL,
+		      vmw_timeline_signal_ioctl,
+		      DRM_RENDER_ALLOW),
 };
 
 static const struct pci_device_id vmw_pci_id_list[] = {
@@ -262,6 +293,8 @@ static int vmw_restrict_iommu;
 static int vmw_force_coherent;
 static int vmw_restrict_dma_mask;
 static int vmw_assume_16bpp;
+static int vmw_irq_moderation = 1;
+static int vmw_flip_on_vblank;
 
 static int vmw_probe(struct pci_dev *, const struct pci_device_id *);
 static void vmw_master_init(struct vmw_master *);
@@ -280,6 +313,12 @@ MODULE_PARM_DESC(restrict_dma_mask, "Restrict DMA mask to 44 bits with IOMMU");
 module_param_named(restrict_dma_mask, vmw_restrict_dma_mask, int, 0600);
 MODULE_PARM_DESC(assume_16bpp, "Assume 16-bpp when filtering modes");
 module_param_named(assume_16bpp, vmw_assume_16bpp, int, 0600);
+MODULE_PARM_DESC(irq_moderation,
+		 "Poll fences instead of using irqs at high submission rates");
+module_param_named(irq_moderation, vmw_irq_moderation, int, 0600);
+MODULE_PARM_DESC(flip_on_vblank,
+		 "Complete page flips at the next emulated vblank");
+module_param_named(flip_on_vblank, vmw_flip_on_vblank, int, 0600);
 
 #ifdef VMWGFX_STANDALONE
 MODULE_PARM_DESC(force_stealth, "Force stealth mode");
@@ -450,6 +489,8 @@ static int vmw_request_device(struct vmw_private *dev_priv)
 		DRM_ERROR("Unable to initialize FIFO.\n");
 		return ret;
 	}
+	atomic_inc(&dev_priv->cursor_gen);
+	WRITE_ONCE(dev_priv->gmrfb_valid, false);
 	vmw_fence_fifo_up(dev_priv->fman);
 	dev_priv->cman = vmw_cmdbuf_man_create(dev_priv);
 	if (IS_ERR(dev_priv->cman)) {
@@ -682,9 +723,14 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 	spin_lock_init(&dev_priv->resource_lock);
 	spin_lock_init(&dev_priv->hw_lock);
 	spin_lock_init(&dev_priv->waiter_lock);
+	vmw_irq_moderation_init(dev_priv);
 	spin_lock_init(&dev_priv->cap_lock);
 	spin_lock_init(&dev_priv->svga_lock);
 	spin_lock_init(&dev_priv->cursor_lock);
+	mutex_init(&dev_priv->cursor_mutex);
+	mutex_init(&dev_priv->gmrfb_mutex);
+	mutex_init(&dev_priv->dma_cache_mutex);
+	INIT_LIST_HEAD(&dev_priv->dma_cache);
 
 	for (i = vmw_res_context; i < vmw_res_max; ++i) {
 		idr_init(&dev_priv->res_idr[i]);
@@ -704,6 +750,7 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 	dev_priv->mmio_start = pci_resource_start(dev->pdev, 2);
 
 	dev_priv->assume_16bpp = !!vmw_assume_16bpp;
+	dev_priv->flip_on_vblank = !!vmw_flip_on_vblank;
 
 	dev_priv->enable_fb = enable_fbdev && !force_stealth;
 
@@ -880,6 +927,7 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 			DRM_ERROR("Failed installing irq: %d\n", ret);
 			goto out_no_irq;
 		}
+		dev_priv->irq_mod_enabled = !!vmw_irq_moderation;
 	}
 
 	dev_priv->fman = vmw_fence_manager_init(dev_priv);
@@ -888,6 +936,12 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 		goto out_no_fman;
 	}
 
+	dev_priv->sched_wq = create_singlethread_workqueue("vmwgfx_sched");
+	if (unlikely(dev_priv->sched_wq == NULL)) {
+		ret = -ENOMEM;
+		goto out_no_sched_wq;
+	}
+
 	ret = ttm_bo_device_init(&dev_priv->bdev,
 				 dev_priv->bo_global_ref.ref.object,
 				 &vmw_bo_driver,
@@ -997,6 +1051,9 @@ out_no_kms:
 out_no_vram:
 	(void)ttm_bo_device_release(&dev_priv->bdev);
 out_no_bdev:
+	destroy_workqueue(dev_priv->sched_wq);
+out_no_sched_wq:
+	vmw_irq_moderation_fini(dev_priv);
 	vmw_fence_manager_takedown(dev_priv->fman);
 out_no_fman:
 	if (dev_priv->capabilities & SVGA_CAP_IRQMASK)
@@ -1029,6 +1086,7 @@ static void vmw_driver_unload(struct drm_device *dev)
 
 	unregister_pm_notifier(&dev_priv->pm_nb);
 
+	vmw_irq_moderation_fini(dev_priv);
 	vmw_kms_lost_device(dev);
 	if (dev_priv->ctx.res_ht_initialized)
 		drm_ht_remove(&dev_priv->ctx.res_ht);
@@ -1053,6 +1111,7 @@ static void vmw_driver_unload(struct drm_device *dev)
 		(void) ttm_bo_clean_mm(&dev_priv->bdev, VMW_PL_MOB);
 	(void) ttm_bo_device_release(&dev_priv->bdev);
 	vmw_release_device_late(dev_priv);
+	destroy_workqueue(dev_priv->sched_wq);
 	vmw_fence_manager_takedown(dev_priv->fman);
 	if (dev_priv->capabilities & SVGA_CAP_IRQMASK)
 		drm_irq_uninstall(dev_priv->dev);
@@ -1070,6 +1129,7 @@ static void vmw_driver_unload(struct drm_device *dev)
 	for (i = vmw_res_context; i < vmw_res_max; ++i)
 		idr_destroy(&dev_priv->res_idr[i]);
 
+	kfree(dev_priv->cursor_image.image);
 	kfree(dev_priv);
 }
 
@@ -1089,6 +1149,7 @@ static void vmw_postclose(struct drm_device *dev,
 		drm_master_put(&vmw_fp->locked_master);
 	}
 
+	vmw_sched_entity_fini(&vmw_fp->entity);
 	ttm_object_file_release(&vmw_fp->tfile);
 	kfree(vmw_fp);
 }
@@ -1113,6 +1174,7 @@ static int vmw_driver_open(struct drm_device *dev, struct drm_file *file_priv)
 	if (unlikely(vmw_fp->tfile == NULL))
 		goto out_no_tfile;
 
+	vmw_sched_entity_init(dev_priv, file_priv, &vmw_fp->entity);
 	file_priv->driver_priv = vmw_fp;
 
 	return 0;
@@ -1367,6 +1429,9 @@ static void __vmw_svga_enable(struct vmw_private *dev_priv)
 	if (!dev_priv->bdev.man[TTM_PL_VRAM].use_type) {
 		vmw_write(dev_priv, SVGA_REG_ENABLE, SVGA_REG_ENABLE);
 		dev_priv->bdev.man[TTM_PL_VRAM].use_type = true;
+		/* The device cursor and GMRFB didn't survive SVGA mode off. */
+		atomic_inc(&dev_priv->cursor_gen);
+		WRITE_ONCE(dev_priv->gmrfb_valid, false);
 	}
 	spin_unlock(&dev_priv->svga_lock);
 }
@@ -1610,6 +1675,38 @@ static const struct dev_pm_ops vmw_pm_ops = {
 	.resume = vmw_pm_resume,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static int vmw_dma_stats_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct vmw_private *dev_priv = vmw_priv(node->minor->dev);
+	unsigned long cache_pages;
+
+	mutex_lock(&dev_priv->dma_cache_mutex);
+	cache_pages = dev_priv->dma_cache_pages;
+	mutex_unlock(&dev_priv->dma_cache_mutex);
+
+	seq_printf(m, "maps: %lld\n",
+		   (long long) atomic64_read(&dev_priv->dma_maps));
+	seq_printf(m, "unmaps: %lld\n",
+		   (long long) atomic64_read(&dev_priv->dma_unmaps));
+	seq_printf(m, "cached pages: %lu\n", cache_pages);
+
+	return 0;
+}
+
+static const struct drm_info_list vmw_debugfs_list[] = {
+	{"dma_stats", vmw_dma_stats_info, 0},
+};
+
+static int vmw_debugfs_init(struct drm_minor *minor)
+{
+	return drm_debugfs_create_files(vmw_debugfs_list,
+					ARRAY_SIZE(vmw_debugfs_list),
+					minor->debugfs_root, minor);
+}
+#endif
+
 static const struct file_operations vmwgfx_driver_fops = {
 	.owner = THIS_MODULE,
 	.open = drm_open,
@@ -1656,6 +1753,9 @@ static struct drm_driver driver = {
 	.prime_handle_to_fd = vmw_prime_handle_to_fd,
 
 	.legacy_hotspot = vmw_kms_legacy_hotspot,
+#if defined(CONFIG_DEBUG_FS)
+	.debugfs_init = vmw_debugfs_init,
+#endif
 
 	.fops = &vmwgfx_driver_fops,
 	.name = VMWGFX_DRIVER_NAME,
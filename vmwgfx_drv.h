@@ -45,7 +45,7 @@
 
 #define VMWGFX_DRIVER_DATE "20180704"
 #define VMWGFX_DRIVER_MAJOR 2
-#define VMWGFX_DRIVER_MINOR 15
+#define VMWGFX_DRIVER_MINOR 17
 #define VMWGFX_DRIVER_PATCHLEVEL 0
 #define VMWGFX_FILE_PAGE_OFFSET 0x00100000
 #define VMWGFX_FIFO_STATIC_SIZE (1024*1024)
@@ -79,11 +79,42 @@
 #define VMW_RES_STREAM ttm_driver_type2
 #define VMW_RES_FENCE ttm_driver_type3
 #define VMW_RES_SHADER ttm_driver_type4
+#define VMW_RES_TIMELINE ttm_driver_type5
+
+#define VMW_SCHED_MAX_DEPS 64
+
+/**
+ * struct vmw_sched_entity - Per-file queue of deferred command submissions
+ *
+ * @lock: Protects @jobs, @closed and the job waiting state. Irq-safe since
+ * it's taken from fence callbacks.
+ * @jobs: Deferred jobs in submission order.
+ * @work: Work item submitting the head of @jobs once its dependencies have
+ * signaled.
+ * @dev_priv: Pointer to the device private structure.
+ * @file_priv: The file the jobs were submitted on.
+ * @context: Fence context of the job fences.
+ * @seqno: Last job fence seqno.
+ * @closed: The file is being closed. No more work will be queued.
+ * @idle_queue: Wait queue for waiters on @jobs to become empty.
+ */
+struct vmw_sched_entity {
+	spinlock_t lock;
+	struct list_head jobs;
+	struct work_struct work;
+	struct vmw_private *dev_priv;
+	struct drm_file *file_priv;
+	u64 context;
+	unsigned int seqno;
+	bool closed;
+	wait_queue_head_t idle_queue;
+};
 
 struct vmw_fpriv {
 	struct drm_master *locked_master;
 	struct ttm_object_file *tfile;
 	bool gb_aware; /* user-space is guest-backed aware */
+	struct vmw_sched_entity entity;
 };
 
 struct vmw_buffer_object {
@@ -269,6 +300,7 @@ enum vmw_dma_map_mode {
  *
  * @sgt: Pointer to a struct sg_table with binding information
  * @num_regions: Number of regions with device-address contiguous pages
+ * @max_addr: Highest device address of any page in the table
  */
 struct vmw_sg_table {
 	enum vmw_dma_map_mode mode;
@@ -277,6 +309,7 @@ struct vmw_sg_table {
 	struct sg_table *sgt;
 	unsigned long num_regions;
 	unsigned long num_pages;
+	dma_addr_t max_addr;
 };
 
 /**
@@ -451,6 +484,7 @@ struct vmw_private {
 	spinlock_t cap_lock;
 	bool has_dx;
 	bool assume_16bpp;
+	bool flip_on_vblank;
 	bool has_sm4_1;
 
 	/*
@@ -485,10 +519,40 @@ struct vmw_private {
 	struct vmw_overlay *overlay_priv;
 	struct drm_property *hotplug_mode_update_property;
 	struct drm_property *implicit_placement_property;
+	struct drm_property *damage_clips_property;
 	unsigned num_implicit;
 	struct vmw_framebuffer *implicit_fb;
 	struct mutex global_kms_state_mutex;
 	spinlock_t cursor_lock;
+
+	/*
+	 * The device holds a single cursor image. Copy of the image last
+	 * defined, so that redefining an identical image can be skipped.
+	 * @cursor_gen is bumped without locks whenever the device may have
+	 * lost its cursor image, and the copy is only valid if its @gen
+	 * matches.
+	 */
+	struct mutex cursor_mutex;
+	atomic_t cursor_gen;
+	struct {
+		bool valid;
+		int gen;
+		u32 *image;
+		u32 hash;
+		u32 width;
+		u32 height;
+		u32 hotspot_x;
+		u32 hotspot_y;
+	} cursor_image; /* Protected by cursor_mutex */
+
+	/*
+	 * The GMRFB is device global state. Serializes screen object blits
+	 * against GMRFB redefinitions and records the GMRFB last defined,
+	 * so that it's redefined only when it changes.
+	 */
+	struct mutex gmrfb_mutex;
+	SVGAFifoCmdDefineGMRFB gmrfb; /* Protected by gmrfb_mutex */
+	bool gmrfb_valid;
 	struct drm_atomic_state *suspend_state;
 
 	/*
@@ -526,6 +590,45 @@ struct vmw_private {
 	uint32_t last_read_seqno;
 	struct vmw_fence_manager *fman;
 	uint32_t irq_mask; /* Updates protected by waiter_lock */
+	uint32_t irq_mask_hw; /* Protected by waiter_lock */
+
+	/*
+	 * IRQ moderation.
+	 */
+
+	bool irq_mod_enabled; /* Protected by waiter_lock */
+	bool irq_moderated; /* Protected by waiter_lock */
+	atomic_t irq_mod_submits;
+	unsigned long irq_mod_stamp; /* Protected by waiter_lock */
+	struct delayed_work irq_poll_work;
+	atomic_t reg_accesses;
+	u32 reg_access_last; /* Protected by waiter_lock */
+	unsigned long reg_access_stamp; /* Protected by waiter_lock */
+
+	/*
+	 * CPU blit statistics, in pixels.
+	 */
+
+	atomic64_t cpu_blit_modified;
+	atomic64_t cpu_blit_transferred;
+
+	/*
+	 * DMA mappings of unbound ttms, kept for reuse in
+	 * vmw_dma_map_bind mode.
+	 */
+
+	struct mutex dma_cache_mutex;
+	struct list_head dma_cache; /* Protected by dma_cache_mutex */
+	unsigned long dma_cache_pages; /* Protected by dma_cache_mutex */
+	atomic64_t dma_maps;
+	atomic64_t dma_unmaps;
+
+	/*
+	 * Deferred command submission. Jobs may run for a long time, so they
+	 * are kept off the system workqueue.
+	 */
+
+	struct workqueue_struct *sched_wq;
 
 	/*
 	 * Device state
@@ -634,9 +737,22 @@ static inline struct vmw_master *vmw_master(struct drm_master *master)
  * Instead we have the extra benefit of being sure that we don't forget
  * the hw lock around register accesses.
  */
+/**
+ * vmw_reg_access_count - Account register accesses causing a VM exit
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @count: Number of port accesses.
+ */
+static inline void vmw_reg_access_count(struct vmw_private *dev_priv,
+					int count)
+{
+	atomic_add(count, &dev_priv->reg_accesses);
+}
+
 static inline void vmw_write(struct vmw_private *dev_priv,
 			     unsigned int offset, uint32_t value)
 {
+	vmw_reg_access_count(dev_priv, 2);
 	spin_lock(&dev_priv->hw_lock);
 	outl(offset, dev_priv->io_start + VMWGFX_INDEX_PORT);
 	outl(value, dev_priv->io_start + VMWGFX_VALUE_PORT);
@@ -648,6 +764,7 @@ static inline uint32_t vmw_read(struct vmw_private *dev_priv,
 {
 	u32 val;
 
+	vmw_reg_access_count(dev_priv, 2);
 	spin_lock(&dev_priv->hw_lock);
 	outl(offset, dev_priv->io_start + VMWGFX_INDEX_PORT);
 	val = inl(dev_priv->io_start + VMWGFX_VALUE_PORT);
@@ -918,6 +1035,7 @@ extern int vmw_execbuf_process(struct drm_file *file_priv,
 			       struct vmw_private *dev_priv,
 			       void __user *user_commands,
 			       void *kernel_commands,
+			       bool user_copy,
 			       uint32_t command_size,
 			       uint64_t throttle_us,
 			       uint32_t dx_context_handle,
@@ -944,6 +1062,87 @@ extern void vmw_execbuf_copy_fence_user(struct vmw_private *dev_priv,
 					struct sync_file *sync_file);
 bool vmw_cmd_describe(const void *buf, u32 *size, char const **cmd);
 
+/**
+ * Timeline sync objects - vmwgfx_timeline.c
+ */
+
+struct vmw_timeline;
+struct vmw_timeline_point;
+
+/**
+ * struct vmw_timeline_cb - Callback for the submission of a timeline point
+ *
+ * @head: List head for the timeline's callback list.
+ * @point: The point waited for.
+ * @func: Called with the timeline lock held once @point is submitted.
+ */
+struct vmw_timeline_cb {
+	struct list_head head;
+	u64 point;
+	void (*func)(struct vmw_timeline_cb *cb);
+};
+
+extern struct vmw_timeline *vmw_timeline_lookup(struct ttm_object_file *tfile,
+						u32 handle);
+extern void vmw_timeline_unreference(struct vmw_timeline **p_tl);
+extern struct vmw_timeline_point *
+vmw_timeline_reserve(struct vmw_timeline *tl, u64 point);
+extern void vmw_timeline_commit(struct vmw_timeline *tl,
+				struct vmw_timeline_point *pt,
+				struct dma_fence *fence);
+extern void vmw_timeline_cancel(struct vmw_timeline *tl,
+				struct vmw_timeline_point *pt);
+extern int vmw_timeline_attach(struct vmw_timeline *tl, u64 point,
+			       struct dma_fence *fence);
+extern struct dma_fence *vmw_timeline_next_fence(struct vmw_timeline *tl,
+						 u64 point);
+extern long vmw_timeline_wait(struct vmw_timeline *tl, u64 point,
+			      bool for_submit, bool interruptible,
+			      long timeout);
+extern int vmw_timeline_add_submit_cb(struct vmw_timeline *tl, u64 point,
+				      struct vmw_timeline_cb *cb,
+				      void (*func)(struct vmw_timeline_cb *cb));
+extern bool vmw_timeline_remove_submit_cb(struct vmw_timeline *tl,
+					  struct vmw_timeline_cb *cb);
+extern int vmw_timeline_create_ioctl(struct drm_device *dev, void *data,
+				     struct drm_file *file_priv);
+extern int vmw_timeline_unref_ioctl(struct drm_device *dev, void *data,
+				    struct drm_file *file_priv);
+extern int vmw_timeline_query_ioctl(struct drm_device *dev, void *data,
+				    struct drm_file *file_priv);
+extern int vmw_timeline_wait_ioctl(struct drm_device *dev, void *data,
+				   struct drm_file *file_priv);
+extern int vmw_timeline_signal_ioctl(struct drm_device *dev, void *data,
+				     struct drm_file *file_priv);
+
+/**
+ * Deferred command submission - vmwgfx_sched.c
+ */
+
+struct vmw_sched_job;
+
+extern void vmw_sched_entity_init(struct vmw_private *dev_priv,
+				  struct drm_file *file_priv,
+				  struct vmw_sched_entity *entity);
+extern void vmw_sched_entity_fini(struct vmw_sched_entity *entity);
+extern bool vmw_sched_entity_idle(struct vmw_sched_entity *entity);
+extern int vmw_sched_entity_flush(struct vmw_sched_entity *entity,
+				  bool interruptible);
+extern struct vmw_sched_job *
+vmw_sched_job_create(struct vmw_sched_entity *entity);
+extern int vmw_sched_job_add_dep(struct vmw_sched_job *job,
+				 struct dma_fence *fence);
+extern void vmw_sched_job_add_timeline_wait(struct vmw_sched_job *job,
+					    struct vmw_timeline *tl,
+					    u64 point);
+extern bool vmw_sched_job_needed(struct vmw_sched_job *job);
+extern int vmw_sched_job_copy_commands(struct vmw_sched_job *job,
+				       void __user *user_commands,
+				       u32 command_size,
+				       u32 context_handle);
+extern struct dma_fence *vmw_sched_job_push(struct vmw_sched_job *job);
+extern void vmw_sched_job_discard(struct vmw_sched_job **p_job);
+
 /**
  * IRQs and wating - vmwgfx_irq.c
  */
@@ -974,6 +1173,10 @@ extern void vmw_generic_waiter_add(struct vmw_private *dev_priv, u32 flag,
 				   int *waiter_count);
 extern void vmw_generic_waiter_remove(struct vmw_private *dev_priv,
 				      u32 flag, int *waiter_count);
+extern void vmw_irq_moderation_init(struct vmw_private *dev_priv);
+extern void vmw_irq_moderation_fini(struct vmw_private *dev_priv);
+extern void vmw_irq_moderation_submit(struct vmw_private *dev_priv);
+extern u32 vmw_reg_access_rate(struct vmw_private *dev_priv);
 
 /**
  * Rudimentary fence-like objects currently used only for throttling -
@@ -1275,10 +1478,17 @@ extern void vmw_cmdbuf_irqthread(struct vmw_cmdbuf_man *man);
 
 /* CPU blit utilities - vmwgfx_blit.c */
 
+/* Maximum number of output rectangles of a diff blit */
+#define VMW_DIFF_MAX_RECTS 8
+
 /**
  * struct vmw_diff_cpy - CPU blit information structure
  *
  * @rect: The output bounding box rectangle.
+ * @rects: The output modified rectangles, coalesced from modified line spans.
+ * @num_rects: Number of rectangles in @rects.
+ * @modified: Number of units found modified, including short unmodified
+ * gaps within modified spans.
  * @line: The current line of the blit.
  * @line_offset: Offset of the current line segment.
  * @cpp: Bytes per pixel (granularity information).
@@ -1286,6 +1496,9 @@ extern void vmw_cmdbuf_irqthread(struct vmw_cmdbuf_man *man);
  */
 struct vmw_diff_cpy {
 	struct drm_rect rect;
+	struct drm_rect rects[VMW_DIFF_MAX_RECTS];
+	unsigned int num_rects;
+	u64 modified;
 	size_t line;
 	size_t line_offset;
 	int cpp;
@@ -3815,10 +3815,27 @@ static int vmw_execbuf_tie_context(struct vmw_private *dev_priv,
 	return 0;
 }
 
+/**
+ * vmw_execbuf_process - Check, patch and submit a command batch.
+ *
+ * @file_priv: The file on whose behalf the commands are submitted.
+ * @dev_priv: Pointer to the device private structure.
+ * @user_commands: User-space address of the command batch, or NULL.
+ * @kernel_commands: Kernel address of the command batch, or NULL.
+ * @user_copy: @kernel_commands is a copy of user-space commands and should
+ * be checked as such.
+ * @command_size: Size of the command batch.
+ * @throttle_us: Throttle lag in microseconds, or zero.
+ * @dx_context_handle: Handle of the DX context of the batch.
+ * @user_fence_rep: User-space address of a struct drm_vmw_fence_rep, or NULL.
+ * @out_fence: If non-NULL, returns a referenced pointer to the fence.
+ * @flags: Execbuf flags.
+ */
 int vmw_execbuf_process(struct drm_file *file_priv,
 			struct vmw_private *dev_priv,
 			void __user *user_commands,
 			void *kernel_commands,
+			bool user_copy,
 			uint32_t command_size,
 			uint64_t throttle_us,
 			uint32_t dx_context_handle,
@@ -3881,7 +3898,7 @@ int vmw_execbuf_process(struct drm_file *file_priv,
 			goto out_unlock;
 		}
 		kernel_commands = sw_context->cmd_bounce;
-	} else if (!header)
+	} else if (!header && !user_copy)
 		sw_context->kernel = true;
 
 	sw_context->fp = vmw_fpriv(file_priv);
@@ -4189,16 +4206,236 @@ void vmw_execbuf_release_pinned_bo(struct vmw_private *dev_priv)
 	mutex_unlock(&dev_priv->cmdbuf_mutex);
 }
 
+/**
+ * vmw_execbuf_add_deps - Add the dependencies of a command submission to a
+ * job.
+ *
+ * @tfile: The ttm object file of the caller.
+ * @job: The job.
+ * @arg: The execbuf ioctl argument.
+ *
+ * Returns 0 on success, negative error code on failure.
+ */
+static int vmw_execbuf_add_deps(struct ttm_object_file *tfile,
+				struct vmw_sched_job *job,
+				struct drm_vmw_execbuf_arg *arg)
+{
+	int32_t __user *fds = (void __user *)(unsigned long)arg->in_fence_fds;
+	uint32_t __user *handles =
+		(void __user *)(unsigned long)arg->in_fence_handles;
+	struct dma_fence *fence;
+	uint32_t i;
+	int ret;
+
+	if (arg->flags & DRM_VMW_EXECBUF_FLAG_IMPORT_FENCE_FD) {
+		fence = sync_file_get_fence(arg->imported_fence_fd);
+		if (!fence) {
+			DRM_ERROR("Cannot get imported fence\n");
+			return -EINVAL;
+		}
+
+		ret = vmw_sched_job_add_dep(job, fence);
+		dma_fence_put(fence);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < arg->num_in_fence_fds; ++i) {
+		int32_t fd;
+
+		if (get_user(fd, &fds[i]))
+			return -EFAULT;
+
+		fence = sync_file_get_fence(fd);
+		if (!fence) {
+			DRM_ERROR("Cannot get in-fence\n");
+			return -EINVAL;
+		}
+
+		ret = vmw_sched_job_add_dep(job, fence);
+		dma_fence_put(fence);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < arg->num_in_fence_handles; ++i) {
+		uint32_t handle;
+
+		if (get_user(handle, &handles[i]))
+			return -EFAULT;
+
+		fence = vmw_user_fence_get(tfile, handle);
+		if (IS_ERR(fence))
+			return PTR_ERR(fence);
+
+		ret = vmw_sched_job_add_dep(job, fence);
+		dma_fence_put(fence);
+		if (ret)
+			return ret;
+	}
+
+	if (arg->flags & DRM_VMW_EXECBUF_FLAG_TIMELINE_WAIT) {
+		struct vmw_timeline *wait_tl;
+
+		wait_tl = vmw_timeline_lookup(tfile, arg->wait_timeline);
+		if (IS_ERR(wait_tl))
+			return PTR_ERR(wait_tl);
+
+		vmw_sched_job_add_timeline_wait(job, wait_tl, arg->wait_point);
+	}
+
+	return 0;
+}
+
+/**
+ * vmw_execbuf_copy_job_fence_user - Copy fence information of a deferred
+ * command submission to user-space.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @user_fence_rep: User space address of a struct drm_vmw_fence_rep, or
+ * NULL.
+ * @out_fence_fd: Exported file descriptor for the finished fence, -1 if
+ * not used.
+ *
+ * There is no fence object for a deferred submission, so the fence handle
+ * and seqno are left zero.
+ *
+ * Returns 0 on success, -EFAULT if copying failed.
+ */
+static int
+vmw_execbuf_copy_job_fence_user(struct vmw_private *dev_priv,
+				struct drm_vmw_fence_rep __user *user_fence_rep,
+				int32_t out_fence_fd)
+{
+	struct drm_vmw_fence_rep fence_rep;
+
+	if (user_fence_rep == NULL)
+		return 0;
+
+	memset(&fence_rep, 0, sizeof(fence_rep));
+	fence_rep.fd = out_fence_fd;
+	vmw_update_seqno(dev_priv, &dev_priv->fifo);
+	fence_rep.passed_seqno = dev_priv->last_read_seqno;
+
+	if (copy_to_user(user_fence_rep, &fence_rep, sizeof(fence_rep)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * vmw_execbuf_sched_submit - Queue a command submission on the scheduling
+ * entity of the caller.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @job: The job holding the dependencies of the submission. Consumed by
+ * this function.
+ * @arg: The execbuf ioctl argument.
+ * @signal_tl: Timeline to signal when the submission has executed, or NULL.
+ * @p_signal_pt: Pointer to the reserved timeline point to signal. Committed
+ * and cleared once the job has been queued.
+ *
+ * Never waits for the dependencies of the submission. Once the job has been
+ * queued, the submission no longer fails.
+ *
+ * Returns 0 on success, negative error code on failure.
+ */
+static int vmw_execbuf_sched_submit(struct vmw_private *dev_priv,
+				    struct vmw_sched_job *job,
+				    struct drm_vmw_execbuf_arg *arg,
+				    struct vmw_timeline *signal_tl,
+				    struct vmw_timeline_point **p_signal_pt)
+{
+	struct drm_vmw_fence_rep __user *user_fence_rep =
+		(void __user *)(unsigned long)arg->fence_rep;
+	struct sync_file *sync_file = NULL;
+	int32_t out_fence_fd = -1;
+	struct dma_fence *fence;
+	int ret;
+
+	ret = vmw_sched_job_copy_commands
+		(job, (void __user *)(unsigned long)arg->commands,
+		 arg->command_size, arg->context_handle);
+	if (ret)
+		goto out_discard;
+
+	if (arg->flags & DRM_VMW_EXECBUF_FLAG_EXPORT_FENCE_FD) {
+		out_fence_fd = get_unused_fd_flags(O_CLOEXEC);
+		if (out_fence_fd < 0) {
+			DRM_ERROR("Failed to get a fence file descriptor.\n");
+			ret = out_fence_fd;
+			goto out_discard;
+		}
+	}
+
+	if (arg->throttle_us) {
+		ret = vmw_wait_lag(dev_priv, &dev_priv->fifo.marker_queue,
+				   arg->throttle_us);
+		if (ret)
+			goto out_free_fence_fd;
+	}
+
+	fence = vmw_sched_job_push(job);
+	job = NULL;
+
+	if (*p_signal_pt) {
+		vmw_timeline_commit(signal_tl, *p_signal_pt, fence);
+		*p_signal_pt = NULL;
+	}
+
+	if (out_fence_fd >= 0) {
+		sync_file = sync_file_create(fence);
+		if (!sync_file) {
+			DRM_ERROR("Unable to create sync file for fence\n");
+			put_unused_fd(out_fence_fd);
+			out_fence_fd = -1;
+		}
+	}
+
+	/*
+	 * Hand out the fd only if user-space gets to know about it.
+	 * Otherwise the submission is still performed, but can only be
+	 * waited for using the timeline.
+	 */
+	if (vmw_execbuf_copy_job_fence_user(dev_priv, user_fence_rep,
+					    out_fence_fd)) {
+		DRM_ERROR("Fence copy error.\n");
+		if (sync_file)
+			fput(sync_file->file);
+	} else if (sync_file) {
+		fd_install(out_fence_fd, sync_file->file);
+		out_fence_fd = -1;
+	}
+
+	dma_fence_put(fence);
+out_free_fence_fd:
+	if (out_fence_fd >= 0)
+		put_unused_fd(out_fence_fd);
+out_discard:
+	if (job)
+		vmw_sched_job_discard(&job);
+
+	return ret;
+}
+
 int vmw_execbuf_ioctl(struct drm_device *dev, unsigned long data,
 		      struct drm_file *file_priv, size_t size)
 {
 	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct vmw_fpriv *vmw_fp = vmw_fpriv(file_priv);
+	struct ttm_object_file *tfile = vmw_fp->tfile;
 	struct drm_vmw_execbuf_arg arg;
 	int ret;
 	static const size_t copy_offset[] = {
 		offsetof(struct drm_vmw_execbuf_arg, context_handle),
+		offsetof(struct drm_vmw_execbuf_arg, wait_timeline),
+		offsetof(struct drm_vmw_execbuf_arg, in_fence_fds),
 		sizeof(struct drm_vmw_execbuf_arg)};
 	struct dma_fence *in_fence = NULL;
+	struct vmw_timeline *signal_tl = NULL;
+	struct vmw_timeline_point *signal_pt = NULL;
+	struct vmw_fence_obj *fence = NULL;
+	struct vmw_sched_job *job = NULL;
 
 	if (unlikely(size < copy_offset[0])) {
 		DRM_ERROR("Invalid command size, ioctl %d\n",
@@ -4232,45 +4469,151 @@ int vmw_execbuf_ioctl(struct drm_device *dev, unsigned long data,
 	switch (arg.version) {
 	case 1:
 		arg.context_handle = (uint32_t) -1;
-		break;
+		/* Fall through. */
 	case 2:
+		arg.flags &= ~(DRM_VMW_EXECBUF_FLAG_TIMELINE_WAIT |
+			       DRM_VMW_EXECBUF_FLAG_TIMELINE_SIGNAL);
+		/* Fall through. */
+	case 3:
+		arg.num_in_fence_fds = 0;
+		arg.num_in_fence_handles = 0;
+		break;
+	case 4:
 	default:
 		break;
 	}
 
-
-	/* If imported a fence FD from elsewhere, then wait on it */
-	if (arg.flags & DRM_VMW_EXECBUF_FLAG_IMPORT_FENCE_FD) {
-		in_fence = sync_file_get_fence(arg.imported_fence_fd);
-
-		if (!in_fence) {
-			DRM_ERROR("Cannot get imported fence\n");
+	if (arg.version >= 4) {
+		/*
+		 * Dependencies are waited for by the scheduler. If there
+		 * are none left, submit directly.
+		 */
+		if (arg.num_in_fence_fds > VMW_SCHED_MAX_DEPS ||
+		    arg.num_in_fence_handles > VMW_SCHED_MAX_DEPS) {
+			DRM_ERROR("Too many in-fences.\n");
 			return -EINVAL;
 		}
 
-		ret = vmw_wait_dma_fence(dev_priv->fman, in_fence);
+		job = vmw_sched_job_create(&vmw_fp->entity);
+		if (IS_ERR(job))
+			return PTR_ERR(job);
+
+		ret = vmw_execbuf_add_deps(tfile, job, &arg);
 		if (ret)
 			goto out;
+
+		if (!vmw_sched_job_needed(job))
+			vmw_sched_job_discard(&job);
+	} else {
+		/* Don't overtake deferred submissions. */
+		ret = vmw_sched_entity_flush(&vmw_fp->entity, true);
+		if (ret)
+			return ret;
+
+		/* If imported a fence FD from elsewhere, then wait on it */
+		if (arg.flags & DRM_VMW_EXECBUF_FLAG_IMPORT_FENCE_FD) {
+			in_fence = sync_file_get_fence(arg.imported_fence_fd);
+
+			if (!in_fence) {
+				DRM_ERROR("Cannot get imported fence\n");
+				return -EINVAL;
+			}
+
+			ret = vmw_wait_dma_fence(dev_priv->fman, in_fence);
+			if (ret)
+				goto out;
+		}
+
+		/*
+		 * Wait for a timeline point. The point need not have been
+		 * submitted yet, in which case we wait for submission first.
+		 */
+		if (arg.flags & DRM_VMW_EXECBUF_FLAG_TIMELINE_WAIT) {
+			struct vmw_timeline *wait_tl;
+			long lret;
+
+			wait_tl = vmw_timeline_lookup(tfile,
+						      arg.wait_timeline);
+			if (IS_ERR(wait_tl)) {
+				ret = PTR_ERR(wait_tl);
+				goto out;
+			}
+
+			lret = vmw_timeline_wait(wait_tl, arg.wait_point,
+						 true, true,
+						 MAX_SCHEDULE_TIMEOUT);
+			vmw_timeline_unreference(&wait_tl);
+			if (lret < 0) {
+				ret = lret;
+				goto out;
+			}
+		}
+	}
+
+	if (arg.flags & DRM_VMW_EXECBUF_FLAG_TIMELINE_SIGNAL) {
+		signal_tl = vmw_timeline_lookup(tfile, arg.signal_timeline);
+		if (IS_ERR(signal_tl)) {
+			ret = PTR_ERR(signal_tl);
+			signal_tl = NULL;
+			goto out;
+		}
+
+		/*
+		 * Reserve the point up front, so that signaling it can't
+		 * fail once the commands have been submitted.
+		 */
+		signal_pt = vmw_timeline_reserve(signal_tl, arg.signal_point);
+		if (IS_ERR(signal_pt)) {
+			DRM_ERROR("Invalid timeline signal point.\n");
+			ret = PTR_ERR(signal_pt);
+			signal_pt = NULL;
+			goto out;
+		}
+	}
+
+	if (job) {
+		ret = vmw_execbuf_sched_submit(dev_priv, job, &arg, signal_tl,
+					       &signal_pt);
+		job = NULL;
+		goto out;
 	}
 
 	ret = ttm_read_lock(&dev_priv->reservation_sem, true);
 	if (unlikely(ret != 0))
-		return ret;
+		goto out;
 
 	ret = vmw_execbuf_process(file_priv, dev_priv,
 				  (void __user *)(unsigned long)arg.commands,
-				  NULL, arg.command_size, arg.throttle_us,
+				  NULL, false, arg.command_size, arg.throttle_us,
 				  arg.context_handle,
 				  (void __user *)(unsigned long)arg.fence_rep,
-				  NULL,
+				  signal_tl ? &fence : NULL,
 				  arg.flags);
 	ttm_read_unlock(&dev_priv->reservation_sem);
 	if (unlikely(ret != 0))
 		goto out;
 
+	/*
+	 * Without a fence, vmw_execbuf_process() has synced, so the point
+	 * may be signaled right away.
+	 */
+	if (signal_pt) {
+		vmw_timeline_commit(signal_tl, signal_pt,
+				    fence ? &fence->base : NULL);
+		signal_pt = NULL;
+	}
+
 	vmw_kms_cursor_post_execbuf(dev_priv);
 
 out:
+	if (job)
+		vmw_sched_job_discard(&job);
+	if (fence)
+		vmw_fence_obj_unreference(&fence);
+	if (signal_pt)
+		vmw_timeline_cancel(signal_tl, signal_pt);
+	if (signal_tl)
+		vmw_timeline_unreference(&signal_tl);
 	if (in_fence)
 		dma_fence_put(in_fence);
 	return ret;
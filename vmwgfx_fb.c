@@ -73,8 +73,21 @@ struct vmw_fb_par {
 	struct drm_crtc *crtc;
 	struct drm_connector *con;
 	struct delayed_work local_work;
+
+	/*
+	 * Framebuffer tiles whose kms framebuffer content is known to have
+	 * been flushed to the display. Protected by bo_mutex.
+	 */
+	struct {
+		unsigned per_row;
+		unsigned long *valid;
+		struct drm_clip_rect *clips;
+	} tiles;
 };
 
+/* Side of the square fbdev change detection tiles, in pixels. */
+#define VMW_FB_TILE_SIZE 64
+
 static int vmw_fb_setcolreg(unsigned regno, unsigned red, unsigned green,
 			    unsigned blue, unsigned transp,
 			    struct fb_info *info)
@@ -167,6 +180,110 @@ static int vmw_fb_blank(int blank, struct fb_info *info)
 	return 0;
 }
 
+/**
+ * vmw_fb_tiles_invalidate - Forget the content of all tiles
+ *
+ * @par: The fbdev private struct.
+ *
+ * Needs to be called whenever the kms framebuffer contents or its position
+ * in the vmalloc framebuffer changes, so that all tiles are flushed on the
+ * next flush. Must be called with @par->bo_mutex held.
+ */
+static void vmw_fb_tiles_invalidate(struct vmw_fb_par *par)
+{
+	unsigned num_tiles = par->tiles.per_row *
+		DIV_ROUND_UP(par->max_height, VMW_FB_TILE_SIZE);
+
+	bitmap_zero(par->tiles.valid, num_tiles);
+}
+
+/**
+ * vmw_fb_tiles_copy - Copy changed tiles to the kms framebuffer
+ *
+ * @par: The fbdev private struct.
+ * @virtual: Kernel virtual address of the kms framebuffer.
+ * @cpp: Bytes per pixel.
+ * @x1: Left side of the dirty region in kms framebuffer coordinates.
+ * @y1: Top side of the dirty region.
+ * @x2: Right side of the dirty region.
+ * @y2: Bottom side of the dirty region.
+ *
+ * Compares each row of the tiles touching the dirty region with the kms
+ * framebuffer and copies only the rows that differ. Tiles with a differing
+ * row, and tiles not flushed since the last invalidation, are coalesced
+ * per tile row into @par->tiles.clips. The kms framebuffer is mapped
+ * cached, so comparing against it is cheap. Must be called with
+ * @par->bo_mutex held.
+ *
+ * Returns the number of clip rects in @par->tiles.clips.
+ */
+static unsigned vmw_fb_tiles_copy(struct vmw_fb_par *par, void *virtual,
+				  u32 cpp, s32 x1, s32 y1, s32 x2, s32 y2)
+{
+	struct fb_info *info = par->vmw_priv->fb_info;
+	u32 dst_pitch = par->set_fb->pitches[0];
+	u32 src_pitch = info->fix.line_length;
+	struct drm_clip_rect *clip = NULL;
+	unsigned num_clips = 0;
+	s32 tx, ty;
+
+	x2 = min_t(s32, x2, par->set_fb->width);
+	y2 = min_t(s32, y2, par->set_fb->height);
+
+	for (ty = y1 / VMW_FB_TILE_SIZE; ty * VMW_FB_TILE_SIZE < y2; ++ty) {
+		s32 top = ty * VMW_FB_TILE_SIZE;
+		s32 bottom = min_t(s32, top + VMW_FB_TILE_SIZE,
+				   par->set_fb->height);
+
+		clip = NULL;
+
+		for (tx = x1 / VMW_FB_TILE_SIZE; tx * VMW_FB_TILE_SIZE < x2;
+		     ++tx) {
+			s32 left = tx * VMW_FB_TILE_SIZE;
+			s32 right = min_t(s32, left + VMW_FB_TILE_SIZE,
+					  par->set_fb->width);
+			unsigned idx = ty * par->tiles.per_row + tx;
+			u32 width = (right - left) * cpp;
+			u8 *src_ptr, *dst_ptr;
+			bool changed;
+			s32 y;
+
+			changed = !__test_and_set_bit(idx, par->tiles.valid);
+
+			src_ptr = (u8 *)par->vmalloc +
+				(top + par->fb_y) * src_pitch +
+				(left + par->fb_x) * cpp;
+			dst_ptr = (u8 *)virtual + top * dst_pitch + left * cpp;
+			for (y = top; y < bottom; ++y) {
+				if (memcmp(dst_ptr, src_ptr, width) != 0) {
+					memcpy(dst_ptr, src_ptr, width);
+					changed = true;
+				}
+				dst_ptr += dst_pitch;
+				src_ptr += src_pitch;
+			}
+
+			if (!changed) {
+				clip = NULL;
+				continue;
+			}
+
+			if (clip) {
+				clip->x2 = right;
+				continue;
+			}
+
+			clip = &par->tiles.clips[num_clips++];
+			clip->x1 = left;
+			clip->x2 = right;
+			clip->y1 = top;
+			clip->y2 = bottom;
+		}
+	}
+
+	return num_clips;
+}
+
 /**
  * vmw_fb_dirty_flush - flush dirty regions to the kms framebuffer
  *
@@ -177,19 +294,19 @@ static int vmw_fb_blank(int blank, struct fb_info *info)
  * corresponding displays. Note that this function runs even if the kms
  * framebuffer is not bound to a crtc and thus not visible, but it's turned
  * off during hibernation using the par->dirty.active bool.
+ * Only rows differing from the kms framebuffer are copied, and only the
+ * tiles containing them are flushed.
  */
 static void vmw_fb_dirty_flush(struct work_struct *work)
 {
 	struct vmw_fb_par *par = container_of(work, struct vmw_fb_par,
 					      local_work.work);
 	struct vmw_private *vmw_priv = par->vmw_priv;
-	struct fb_info *info = vmw_priv->fb_info;
 	unsigned long irq_flags;
 	s32 dst_x1, dst_x2, dst_y1, dst_y2, w = 0, h = 0;
 	u32 cpp, max_x, max_y;
-	struct drm_clip_rect clip;
+	unsigned num_clips = 0;
 	struct drm_framebuffer *cur_fb;
-	u8 *src_ptr, *dst_ptr;
 	struct vmw_buffer_object *vbo = par->vmw_bo;
 	void *virtual;
 
@@ -239,30 +356,17 @@ static void vmw_fb_dirty_flush(struct work_struct *work)
 	par->dirty.y1 = par->dirty.y2 = 0;
 	spin_unlock_irqrestore(&par->dirty.lock, irq_flags);
 
-	if (w && h) {
-		dst_ptr = (u8 *)virtual  +
-			(dst_y1 * par->set_fb->pitches[0] + dst_x1 * cpp);
-		src_ptr = (u8 *)par->vmalloc +
-			((dst_y1 + par->fb_y) * info->fix.line_length +
-			 (dst_x1 + par->fb_x) * cpp);
-
-		while (h-- > 0) {
-			memcpy(dst_ptr, src_ptr, w*cpp);
-			dst_ptr += par->set_fb->pitches[0];
-			src_ptr += info->fix.line_length;
-		}
-
-		clip.x1 = dst_x1;
-		clip.x2 = dst_x2;
-		clip.y1 = dst_y1;
-		clip.y2 = dst_y2;
-	}
+	if (w && h)
+		num_clips = vmw_fb_tiles_copy(par, virtual, cpp,
+					      dst_x1, dst_y1, dst_x2, dst_y2);
 
 out_unreserve:
 	ttm_bo_unreserve(&vbo->base);
 	ttm_read_unlock(&vmw_priv->reservation_sem);
-	if (w && h) {
-		WARN_ON_ONCE(par->set_fb->funcs->dirty(cur_fb, NULL, 0, 0, &clip, 1));
+	if (num_clips) {
+		WARN_ON_ONCE(par->set_fb->funcs->dirty(cur_fb, NULL, 0, 0,
+						       par->tiles.clips,
+						       num_clips));
 		vmw_fifo_flush(vmw_priv, false);
 	}
 out_unlock:
@@ -318,6 +422,7 @@ static int vmw_fb_pan_display(struct fb_var_screeninfo *var,
 	mutex_lock(&par->bo_mutex);
 	par->fb_x = var->xoffset;
 	par->fb_y = var->yoffset;
+	vmw_fb_tiles_invalidate(par);
 	if (par->set_fb)
 		vmw_fb_dirty_mark(par, par->fb_x, par->fb_y, par->set_fb->width,
 				  par->set_fb->height);
@@ -599,6 +704,7 @@ static int vmw_fb_kms_framebuffer(struct fb_info *info)
 		return PTR_ERR(vfb);
 
 	par->set_fb = &vfb->base;
+	vmw_fb_tiles_invalidate(par);
 
 	return 0;
 }
@@ -648,6 +754,7 @@ static int vmw_fb_set_par(struct fb_info *info)
 
 	par->fb_x = var->xoffset;
 	par->fb_y = var->yoffset;
+	vmw_fb_tiles_invalidate(par);
 
 	set.crtc = par->crtc;
 	set.x = 0;
@@ -699,6 +806,7 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 	struct fb_info *info;
 	unsigned fb_width, fb_height;
 	unsigned fb_bpp, fb_depth, fb_offset, fb_pitch, fb_size;
+	unsigned num_tiles;
 	struct drm_display_mode *init_mode;
 	int ret;
 
@@ -747,6 +855,18 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 		goto err_free;
 	}
 
+	par->tiles.per_row = DIV_ROUND_UP(fb_width, VMW_FB_TILE_SIZE);
+	num_tiles = par->tiles.per_row *
+		DIV_ROUND_UP(fb_height, VMW_FB_TILE_SIZE);
+	par->tiles.valid = kcalloc(BITS_TO_LONGS(num_tiles),
+				   sizeof(*par->tiles.valid), GFP_KERNEL);
+	par->tiles.clips = kcalloc(num_tiles, sizeof(*par->tiles.clips),
+				   GFP_KERNEL);
+	if (unlikely(!par->tiles.valid || !par->tiles.clips)) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
 	/*
 	 * Fixed and var
 	 */
@@ -840,6 +960,8 @@ err_aper:
 #endif
 #endif
 err_free:
+	kfree(par->tiles.clips);
+	kfree(par->tiles.valid);
 	vfree(par->vmalloc);
 err_kms:
 	framebuffer_release(info);
@@ -868,6 +990,8 @@ int vmw_fb_close(struct vmw_private *vmw_priv)
 	(void) vmw_fb_kms_detach(par, true, true);
 	mutex_unlock(&par->bo_mutex);
 
+	kfree(par->tiles.clips);
+	kfree(par->tiles.valid);
 	vfree(par->vmalloc);
 	framebuffer_release(info);
 
@@ -912,6 +1036,11 @@ int vmw_fb_on(struct vmw_private *vmw_priv)
 	info = vmw_priv->fb_info;
 	par = info->par;
 
+	/* The kms framebuffer contents may not have survived. */
+	mutex_lock(&par->bo_mutex);
+	vmw_fb_tiles_invalidate(par);
+	mutex_unlock(&par->bo_mutex);
+
 	spin_lock_irqsave(&par->dirty.lock, flags);
 	par->dirty.active = true;
 	spin_unlock_irqrestore(&par->dirty.lock, flags);
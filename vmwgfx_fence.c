@@ -44,8 +44,18 @@ struct vmw_fence_manager {
 	uint32_t pending_actions[VMW_ACTION_MAX];
 	struct mutex goal_irq_mutex;
 	bool goal_irq_on; /* Protected by @goal_irq_mutex */
-	bool seqno_valid; /* Protected by @lock, and may not be set to true
-			     without the @goal_irq_mutex held. */
+	bool seqno_valid; /* Protected by @lock. If set to true without the
+			     @goal_irq_mutex held, @work must be scheduled
+			     to turn on the goal irq. */
+	/*
+	 * All device fences share a single fence context. The device
+	 * executes all command buffers in order, so a fence always implies
+	 * all fences with lower seqnos, regardless of which (DX) context
+	 * submitted it. That lets reservation objects replace any older
+	 * device fence with a newer one, keeping shared fence arrays at a
+	 * single device fence. Per-context fence contexts would need one
+	 * slot per context.
+	 */
 	unsigned ctx;
 };
 
@@ -105,7 +115,10 @@ fman_from_fence(struct vmw_fence_obj *fence)
  * the subsystem makes sure the fence goal seqno is updated.
  *
  * The fence goal seqno irq is on as long as there are unsignaled fence
- * objects with actions attached to them.
+ * objects with actions attached to them. Fences that have had signaling
+ * enabled, typically because a dma_fence callback was added to them, are
+ * treated the same way, so that the callbacks are called without anybody
+ * waiting on the fence.
  */
 
 static void vmw_fence_obj_destroy(struct dma_fence *f)
@@ -132,6 +145,8 @@ static const char *vmw_fence_get_timeline_name(struct dma_fence *f)
 	return "svga";
 }
 
+static bool vmw_fence_goal_check_locked(struct vmw_fence_obj *fence);
+
 static bool vmw_fence_enable_signaling(struct dma_fence *f)
 {
 	struct vmw_fence_obj *fence =
@@ -147,6 +162,13 @@ static bool vmw_fence_enable_signaling(struct dma_fence *f)
 
 	vmw_fifo_ping_host(dev_priv, SVGA_SYNC_GENERIC);
 
+	/*
+	 * We're called with the fence manager lock held and can't grab the
+	 * goal_irq_mutex. Let the worker turn on the goal irq.
+	 */
+	if (vmw_fence_goal_check_locked(fence))
+		(void) schedule_work(&fman->work);
+
 	return true;
 }
 
@@ -295,6 +317,11 @@ static void vmw_fence_work_func(struct work_struct *work)
 		if (!seqno_valid && fman->goal_irq_on) {
 			fman->goal_irq_on = false;
 			vmw_goal_waiter_remove(fman->dev_priv);
+		} else if (seqno_valid && !fman->goal_irq_on) {
+			fman->goal_irq_on = true;
+			vmw_goal_waiter_add(fman->dev_priv);
+			/* The goal may have passed before the irq was on. */
+			vmw_fences_update(fman);
 		}
 		mutex_unlock(&fman->goal_irq_mutex);
 
@@ -411,7 +438,8 @@ static void vmw_fences_perform_actions(struct vmw_fence_manager *fman,
  * we might need to update the fence goal. It checks to see whether
  * the current fence goal has already passed, and, in that case,
  * scans through all unsignaled fences to get the next fence object with an
- * action attached, and sets the seqno of that fence as a new fence goal.
+ * action attached or signaling enabled, and sets the seqno of that fence as
+ * a new fence goal.
  *
  * returns true if the device goal seqno was updated. False otherwise.
  */
@@ -432,7 +460,9 @@ static bool vmw_fence_goal_new_locked(struct vmw_fence_manager *fman,
 
 	fman->seqno_valid = false;
 	list_for_each_entry(fence, &fman->fence_list, head) {
-		if (!list_empty(&fence->seq_passed_actions)) {
+		if (!list_empty(&fence->seq_passed_actions) ||
+		    test_bit(DMA_FENCE_FLAG_ENABLE_SIGNAL_BIT,
+			     &fence->base.flags)) {
 			fman->seqno_valid = true;
 			vmw_mmio_write(fence->base.seqno,
 				       fifo_mem + SVGA_FIFO_FENCE_GOAL);
@@ -560,6 +590,21 @@ void vmw_fence_obj_flush(struct vmw_fence_obj *fence)
 	vmw_fifo_ping_host(dev_priv, SVGA_SYNC_GENERIC);
 }
 
+/**
+ * vmw_fence_is_native - Check whether a dma_fence is a fence of this device
+ *
+ * @fman: Pointer to the fence manager.
+ * @fence: The dma_fence to check.
+ *
+ * Commands are executed by the device in submission order, so a command
+ * submission never needs to wait for a native fence to signal.
+ */
+bool vmw_fence_is_native(struct vmw_fence_manager *fman,
+			 struct dma_fence *fence)
+{
+	return fence->context == fman->ctx;
+}
+
 static void vmw_fence_destroy(struct vmw_fence_obj *fence)
 {
 	dma_fence_free(&fence->base);
@@ -810,6 +855,32 @@ vmw_fence_obj_lookup(struct ttm_object_file *tfile, u32 handle)
 	return base;
 }
 
+/**
+ * vmw_user_fence_get - Look up the dma_fence of a user-space fence handle
+ *
+ * @tfile: The ttm object file the handle is registered with.
+ * @handle: The fence object handle.
+ *
+ * Returns a refcounted pointer to the fence's struct dma_fence on success,
+ * an error pointer on failure.
+ */
+struct dma_fence *vmw_user_fence_get(struct ttm_object_file *tfile,
+				     u32 handle)
+{
+	struct ttm_base_object *base = vmw_fence_obj_lookup(tfile, handle);
+	struct vmw_user_fence *ufence;
+	struct dma_fence *fence;
+
+	if (IS_ERR(base))
+		return ERR_CAST(base);
+
+	ufence = container_of(base, struct vmw_user_fence, base);
+	fence = dma_fence_get(&ufence->fence.base);
+	ttm_base_object_unref(&base);
+
+	return fence;
+}
+
 
 int vmw_fence_obj_wait_ioctl(struct drm_device *dev, void *data,
 			     struct drm_file *file_priv)
@@ -973,7 +1044,7 @@ static void vmw_event_fence_action_cleanup(struct vmw_fence_action *action)
  * Note that the action callbacks may be executed before this function
  * returns.
  */
-static void vmw_fence_obj_add_action(struct vmw_fence_obj *fence,
+void vmw_fence_obj_add_action(struct vmw_fence_obj *fence,
 			      struct vmw_fence_action *action)
 {
 	struct vmw_fence_manager *fman = fman_from_fence(fence);
@@ -41,12 +41,15 @@ struct vmw_private;
 
 struct vmw_fence_manager;
 
+struct ttm_object_file;
+
 /**
  *
  *
  */
 enum vmw_action_type {
 	VMW_ACTION_EVENT = 0,
+	VMW_ACTION_SCHED,
 	VMW_ACTION_MAX
 };
 
@@ -98,6 +101,15 @@ extern int vmw_fence_obj_wait(struct vmw_fence_obj *fence,
 
 extern void vmw_fence_obj_flush(struct vmw_fence_obj *fence);
 
+extern void vmw_fence_obj_add_action(struct vmw_fence_obj *fence,
+				     struct vmw_fence_action *action);
+
+extern struct dma_fence *vmw_user_fence_get(struct ttm_object_file *tfile,
+					    u32 handle);
+
+extern bool vmw_fence_is_native(struct vmw_fence_manager *fman,
+				struct dma_fence *fence);
+
 extern int vmw_fence_create(struct vmw_fence_manager *fman,
 			    uint32_t seqno,
 			    struct vmw_fence_obj **p_fence);
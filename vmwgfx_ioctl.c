@@ -119,6 +119,18 @@ int vmw_getparam_ioctl(struct drm_device *dev, void *data,
 	case DRM_VMW_PARAM_SM4_1:
 		param->value = dev_priv->has_sm4_1;
 		break;
+	case DRM_VMW_PARAM_TIMELINE:
+		param->value = 1;
+		break;
+	case DRM_VMW_PARAM_REG_ACCESS_RATE:
+		param->value = vmw_reg_access_rate(dev_priv);
+		break;
+	case DRM_VMW_PARAM_CPU_BLIT_MODIFIED:
+		param->value = atomic64_read(&dev_priv->cpu_blit_modified);
+		break;
+	case DRM_VMW_PARAM_CPU_BLIT_TRANSFERRED:
+		param->value = atomic64_read(&dev_priv->cpu_blit_transferred);
+		break;
 	default:
 		DRM_ERROR("Illegal vmwgfx get param request: %d\n",
 			  param->param);
@@ -290,6 +302,7 @@ int vmw_present_ioctl(struct drm_device *dev, void *data,
 	}
 
 	drm_modeset_lock_all(dev);
+	vmw_kms_wait_for_commits(dev);
 
 	fb = drm_framebuffer_lookup(dev, arg->fb_id);
 	if (!fb) {
@@ -373,6 +386,7 @@ int vmw_present_readback_ioctl(struct drm_device *dev, void *data,
 	}
 
 	drm_modeset_lock_all(dev);
+	vmw_kms_wait_for_commits(dev);
 
 	fb = drm_framebuffer_lookup(dev, arg->fb_id);
 	if (!fb) {
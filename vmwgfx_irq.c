@@ -30,6 +30,22 @@
 
 #define VMW_FENCE_WRAP (1 << 24)
 
+/*
+ * IRQ moderation: At high submission rates, fence and command buffer
+ * interrupts, and the irq mask updates done as the number of waiters goes
+ * between zero and one, cost a VM exit per register access. While
+ * moderated, these interrupts are kept masked, and the device fence seqno
+ * is instead polled from the submission path and from a delayed work item.
+ * Interrupts are turned back on when the submission rate drops and the
+ * device has caught up with all submitted fences.
+ */
+#define VMW_IRQ_MOD_FLAGS (SVGA_IRQFLAG_ANY_FENCE |	\
+			   SVGA_IRQFLAG_FENCE_GOAL |	\
+			   SVGA_IRQFLAG_COMMAND_BUFFER)
+#define VMW_IRQ_MOD_WINDOW (HZ / 10)
+#define VMW_IRQ_MOD_ENTER_SUBMITS 100
+#define VMW_IRQ_MOD_LEAVE_SUBMITS 10
+
 /**
  * vmw_thread_fn - Deferred (process context) irq handler
  *
@@ -83,9 +99,12 @@ irqreturn_t vmw_irq_handler(int irq, void *arg)
 
 	status = inl(dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 	masked_status = status & READ_ONCE(dev_priv->irq_mask);
+	vmw_reg_access_count(dev_priv, 1);
 
-	if (likely(status))
+	if (likely(status)) {
 		outl(status, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
+		vmw_reg_access_count(dev_priv, 1);
+	}
 
 	if (!status)
 		return IRQ_NONE;
@@ -234,14 +253,44 @@ out_err:
 	return ret;
 }
 
+/**
+ * vmw_irq_mask_update_locked - Write the irq mask to the device if needed
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Computes the irq mask from @dev_priv->irq_mask and the moderation state,
+ * and writes it to the device only if it differs from the mask last
+ * written. Stale status of interrupts about to be unmasked is cleared.
+ * Must be called with the waiter_lock held.
+ */
+static void vmw_irq_mask_update_locked(struct vmw_private *dev_priv)
+{
+	u32 hw_mask = dev_priv->irq_mask;
+	u32 unmasked;
+
+	if (dev_priv->irq_moderated)
+		hw_mask &= ~VMW_IRQ_MOD_FLAGS;
+
+	if (hw_mask == dev_priv->irq_mask_hw)
+		return;
+
+	unmasked = hw_mask & ~dev_priv->irq_mask_hw;
+	if (unmasked) {
+		outl(unmasked, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
+		vmw_reg_access_count(dev_priv, 1);
+	}
+
+	dev_priv->irq_mask_hw = hw_mask;
+	vmw_write(dev_priv, SVGA_REG_IRQMASK, hw_mask);
+}
+
 void vmw_generic_waiter_add(struct vmw_private *dev_priv,
 			    u32 flag, int *waiter_count)
 {
 	spin_lock_bh(&dev_priv->waiter_lock);
 	if ((*waiter_count)++ == 0) {
-		outl(flag, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 		dev_priv->irq_mask |= flag;
-		vmw_write(dev_priv, SVGA_REG_IRQMASK, dev_priv->irq_mask);
+		vmw_irq_mask_update_locked(dev_priv);
 	}
 	spin_unlock_bh(&dev_priv->waiter_lock);
 }
@@ -252,11 +301,161 @@ void vmw_generic_waiter_remove(struct vmw_private *dev_priv,
 	spin_lock_bh(&dev_priv->waiter_lock);
 	if (--(*waiter_count) == 0) {
 		dev_priv->irq_mask &= ~flag;
-		vmw_write(dev_priv, SVGA_REG_IRQMASK, dev_priv->irq_mask);
+		vmw_irq_mask_update_locked(dev_priv);
+	}
+	spin_unlock_bh(&dev_priv->waiter_lock);
+}
+
+/**
+ * vmw_irq_poll - Poll the device for passed fences and finished command
+ * buffers.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Performs the work of the irq thread for the moderated interrupts.
+ */
+static void vmw_irq_poll(struct vmw_private *dev_priv)
+{
+	u32 seqno = dev_priv->last_read_seqno;
+
+	vmw_update_seqno(dev_priv, &dev_priv->fifo);
+	if (dev_priv->last_read_seqno != seqno)
+		wake_up_all(&dev_priv->fence_queue);
+
+	if (dev_priv->cman)
+		vmw_cmdbuf_irqthread(dev_priv->cman);
+}
+
+static void vmw_irq_poll_work_func(struct work_struct *work)
+{
+	struct vmw_private *dev_priv =
+		container_of(work, struct vmw_private, irq_poll_work.work);
+	bool moderated;
+
+	vmw_irq_poll(dev_priv);
+
+	spin_lock_bh(&dev_priv->waiter_lock);
+	if (dev_priv->irq_moderated &&
+	    time_after_eq(jiffies,
+			  dev_priv->irq_mod_stamp + VMW_IRQ_MOD_WINDOW)) {
+		if (atomic_read(&dev_priv->irq_mod_submits) <
+		    VMW_IRQ_MOD_LEAVE_SUBMITS &&
+		    dev_priv->last_read_seqno ==
+		    atomic_read(&dev_priv->marker_seq)) {
+			dev_priv->irq_moderated = false;
+			vmw_irq_mask_update_locked(dev_priv);
+		}
+		atomic_set(&dev_priv->irq_mod_submits, 0);
+		dev_priv->irq_mod_stamp = jiffies;
+	}
+
+	moderated = dev_priv->irq_moderated;
+	if (moderated)
+		(void) schedule_delayed_work(&dev_priv->irq_poll_work, 1);
+	spin_unlock_bh(&dev_priv->waiter_lock);
+
+	/* Catch up with what happened while interrupts were masked. */
+	if (!moderated)
+		vmw_irq_poll(dev_priv);
+}
+
+/**
+ * vmw_irq_moderation_init - Initialize IRQ moderation state
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * IRQ moderation is initially off and needs to be enabled by setting
+ * @dev_priv->irq_mod_enabled.
+ */
+void vmw_irq_moderation_init(struct vmw_private *dev_priv)
+{
+	dev_priv->irq_mod_enabled = false;
+	dev_priv->irq_moderated = false;
+	atomic_set(&dev_priv->irq_mod_submits, 0);
+	dev_priv->irq_mod_stamp = jiffies;
+	INIT_DELAYED_WORK(&dev_priv->irq_poll_work, vmw_irq_poll_work_func);
+	atomic_set(&dev_priv->reg_accesses, 0);
+	dev_priv->reg_access_last = 0;
+	dev_priv->reg_access_stamp = jiffies;
+}
+
+/**
+ * vmw_irq_moderation_fini - Stop IRQ moderation
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Turns interrupts back on and stops polling. Must be called before the
+ * fence manager and the command buffer manager are taken down.
+ */
+void vmw_irq_moderation_fini(struct vmw_private *dev_priv)
+{
+	spin_lock_bh(&dev_priv->waiter_lock);
+	dev_priv->irq_mod_enabled = false;
+	dev_priv->irq_moderated = false;
+	vmw_irq_mask_update_locked(dev_priv);
+	spin_unlock_bh(&dev_priv->waiter_lock);
+
+	cancel_delayed_work_sync(&dev_priv->irq_poll_work);
+}
+
+/**
+ * vmw_irq_moderation_submit - Account a submission for IRQ moderation
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Called for each fence emitted. Masks fence and command buffer interrupts
+ * and starts polling if fences are emitted frequently enough.
+ */
+void vmw_irq_moderation_submit(struct vmw_private *dev_priv)
+{
+	int submits = atomic_inc_return(&dev_priv->irq_mod_submits);
+
+	if (submits < VMW_IRQ_MOD_ENTER_SUBMITS ||
+	    READ_ONCE(dev_priv->irq_moderated) ||
+	    !READ_ONCE(dev_priv->irq_mod_enabled))
+		return;
+
+	spin_lock_bh(&dev_priv->waiter_lock);
+	if (!dev_priv->irq_moderated && dev_priv->irq_mod_enabled) {
+		if (time_before(jiffies,
+				dev_priv->irq_mod_stamp + VMW_IRQ_MOD_WINDOW)) {
+			dev_priv->irq_moderated = true;
+			vmw_irq_mask_update_locked(dev_priv);
+			(void) schedule_delayed_work(&dev_priv->irq_poll_work,
+						     1);
+		}
+		atomic_set(&dev_priv->irq_mod_submits, 0);
+		dev_priv->irq_mod_stamp = jiffies;
 	}
 	spin_unlock_bh(&dev_priv->waiter_lock);
 }
 
+/**
+ * vmw_reg_access_rate - Get the rate of register accesses causing VM exits
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Returns the average number of accesses per second since the previous
+ * call.
+ */
+u32 vmw_reg_access_rate(struct vmw_private *dev_priv)
+{
+	u32 count = atomic_read(&dev_priv->reg_accesses);
+	unsigned long now = jiffies;
+	unsigned long elapsed;
+	u64 rate;
+
+	spin_lock_bh(&dev_priv->waiter_lock);
+	elapsed = max(now - dev_priv->reg_access_stamp, 1UL);
+	rate = div_u64((u64)(count - dev_priv->reg_access_last) * HZ,
+		       elapsed);
+	dev_priv->reg_access_last = count;
+	dev_priv->reg_access_stamp = now;
+	spin_unlock_bh(&dev_priv->waiter_lock);
+
+	return min_t(u64, rate, U32_MAX);
+}
+
 void vmw_seqno_waiter_add(struct vmw_private *dev_priv)
 {
 	vmw_generic_waiter_add(dev_priv, SVGA_IRQFLAG_ANY_FENCE,
@@ -353,6 +552,7 @@ void vmw_irq_uninstall(struct drm_device *dev)
 		return;
 
 	vmw_write(dev_priv, SVGA_REG_IRQMASK, 0);
+	dev_priv->irq_mask_hw = 0;
 
 	status = inl(dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 	outl(status, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
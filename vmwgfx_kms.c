@@ -25,6 +25,7 @@
  *
  **************************************************************************/
 
+#include <linux/jhash.h>
 #include "vmwgfx_kms.h"
 #include "drm_plane_helper.h"
 #include "drm_atomic.h"
@@ -33,9 +34,11 @@
 
 /* Might need a hrtimer here? */
 #define VMWGFX_PRESENT_RATE ((HZ / 60 > 0) ? HZ / 60 : 1)
+#define VMW_CURSOR_IMAGE_MAX (64 * 64 * 4)
 
 void vmw_du_cleanup(struct vmw_display_unit *du)
 {
+	hrtimer_cancel(&du->vblank_timer);
 	drm_plane_cleanup(&du->primary);
 	drm_plane_cleanup(&du->cursor);
 
@@ -49,6 +52,24 @@ void vmw_du_cleanup(struct vmw_display_unit *du)
  * Display Unit Cursor functions
  */
 
+/**
+ * vmw_cursor_update_image - Define the device cursor image
+ *
+ * @dev_priv: Pointer to the device private struct.
+ * @image: ARGB cursor image.
+ * @width: Image width.
+ * @height: Image height.
+ * @hotspotX: Hotspot x coordinate.
+ * @hotspotY: Hotspot y coordinate.
+ *
+ * Cursors are frequently set again with unchanged content, and each
+ * definition pushes the full image through the FIFO. So a copy of the
+ * image last defined is kept, and the definition is skipped if the device
+ * already holds an identical one. The image hash serves as a quick check
+ * before comparing the images.
+ *
+ * Returns 0 on success, negative error code on failure.
+ */
 static int vmw_cursor_update_image(struct vmw_private *dev_priv,
 				   u32 *image, u32 width, u32 height,
 				   u32 hotspotX, u32 hotspotY)
@@ -59,14 +80,36 @@ static int vmw_cursor_update_image(struct vmw_private *dev_priv,
 	} *cmd;
 	u32 image_size = width * height * 4;
 	u32 cmd_size = sizeof(*cmd) + image_size;
+	u32 hash;
+	int gen;
+	int ret = 0;
 
 	if (!image)
 		return -EINVAL;
 
+	hash = jhash2(image, width * height, 0);
+
+	mutex_lock(&dev_priv->cursor_mutex);
+	/*
+	 * Read the generation before defining, so that a device reset
+	 * racing with the definition invalidates the copy.
+	 */
+	gen = atomic_read(&dev_priv->cursor_gen);
+	if (dev_priv->cursor_image.valid &&
+	    dev_priv->cursor_image.gen == gen &&
+	    dev_priv->cursor_image.hash == hash &&
+	    dev_priv->cursor_image.width == width &&
+	    dev_priv->cursor_image.height == height &&
+	    dev_priv->cursor_image.hotspot_x == hotspotX &&
+	    dev_priv->cursor_image.hotspot_y == hotspotY &&
+	    memcmp(dev_priv->cursor_image.image, image, image_size) == 0)
+		goto out_unlock;
+
 	cmd = vmw_fifo_reserve(dev_priv, cmd_size);
 	if (unlikely(cmd == NULL)) {
 		DRM_ERROR("Fifo reserve failed.\n");
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto out_unlock;
 	}
 
 	memset(cmd, 0, sizeof(*cmd));
@@ -82,7 +125,30 @@ static int vmw_cursor_update_image(struct vmw_private *dev_priv,
 
 	vmw_fifo_commit_flush(dev_priv, cmd_size);
 
-	return 0;
+	dev_priv->cursor_image.valid = false;
+	if (image_size > VMW_CURSOR_IMAGE_MAX)
+		goto out_unlock;
+
+	if (!dev_priv->cursor_image.image) {
+		dev_priv->cursor_image.image =
+			kmalloc(VMW_CURSOR_IMAGE_MAX, GFP_KERNEL);
+		if (!dev_priv->cursor_image.image)
+			goto out_unlock;
+	}
+
+	memcpy(dev_priv->cursor_image.image, image, image_size);
+	dev_priv->cursor_image.valid = true;
+	dev_priv->cursor_image.gen = gen;
+	dev_priv->cursor_image.hash = hash;
+	dev_priv->cursor_image.width = width;
+	dev_priv->cursor_image.height = height;
+	dev_priv->cursor_image.hotspot_x = hotspotX;
+	dev_priv->cursor_image.hotspot_y = hotspotY;
+
+out_unlock:
+	mutex_unlock(&dev_priv->cursor_mutex);
+
+	return ret;
 }
 
 static int vmw_cursor_update_bo(struct vmw_private *dev_priv,
@@ -90,15 +156,11 @@ static int vmw_cursor_update_bo(struct vmw_private *dev_priv,
 				u32 width, u32 height,
 				u32 hotspotX, u32 hotspotY)
 {
-	struct ttm_bo_kmap_obj map;
-	unsigned long kmap_offset;
-	unsigned long kmap_num;
 	void *virtual;
-	bool dummy;
 	int ret;
 
-	kmap_offset = 0;
-	kmap_num = (width*height*4 + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	if (bo->base.num_pages < PFN_UP(width * height * 4))
+		return -EINVAL;
 
 	ret = ttm_bo_reserve(&bo->base, true, false, NULL);
 	if (unlikely(ret != 0)) {
@@ -106,16 +168,14 @@ static int vmw_cursor_update_bo(struct vmw_private *dev_priv,
 		return -EINVAL;
 	}
 
-	ret = ttm_bo_kmap(&bo->base, kmap_offset, kmap_num, &map);
-	if (unlikely(ret != 0))
-		goto err_unreserve;
-
-	virtual = ttm_kmap_obj_virtual(&map, &dummy);
-	ret = vmw_cursor_update_image(dev_priv, virtual, width, height,
-				      hotspotX, hotspotY);
+	/* The map is cached in the bo until it's moved or destroyed. */
+	virtual = vmw_bo_map_and_cache(bo);
+	if (virtual)
+		ret = vmw_cursor_update_image(dev_priv, virtual, width,
+					      height, hotspotX, hotspotY);
+	else
+		ret = -ENOMEM;
 
-	ttm_bo_kunmap(&map);
-err_unreserve:
 	ttm_bo_unreserve(&bo->base);
 
 	return ret;
@@ -603,18 +663,13 @@ void vmw_du_crtc_atomic_begin(struct drm_crtc *crtc,
 }
 
 
+/*
+ * Vblank events are queued for all display units of a commit at once in
+ * vmw_kms_commit_events().
+ */
 void vmw_du_crtc_atomic_flush(struct drm_crtc *crtc,
 			      struct drm_crtc_state *old_crtc_state)
 {
-	struct drm_pending_vblank_event *event = crtc->state->event;
-
-	if (event) {
-		crtc->state->event = NULL;
-
-		spin_lock_irq(&crtc->dev->event_lock);
-		drm_crtc_send_vblank_event(crtc, event);
-		spin_unlock_irq(&crtc->dev->event_lock);
-	}
 }
 
 
@@ -719,6 +774,10 @@ vmw_du_plane_duplicate_state(struct drm_plane *plane)
 	vps->pinned = 0;
 	vps->cpp = 0;
 
+	/* Damage is only valid for the commit it was set in. */
+	vps->damage_clips = NULL;
+	vps->val_ctx = NULL;
+
 	/* Each ref counted resource needs to be acquired again */
 	if (vps->surf)
 		(void) vmw_surface_reference(vps->surf);
@@ -784,10 +843,166 @@ vmw_du_plane_destroy_state(struct drm_plane *plane,
 	if (vps->bo)
 		vmw_bo_unreference(&vps->bo);
 
+	drm_property_blob_put(vps->damage_clips);
+
 	drm_atomic_helper_plane_destroy_state(plane, state);
 }
 
 
+/**
+ * vmw_du_plane_atomic_set_property - Atomic version of set property
+ *
+ * @plane: drm plane
+ * @state: plane state to update
+ * @property: the property to set
+ * @val: new property value
+ *
+ * Returns:
+ * Zero on success, negative errno on failure.
+ */
+int
+vmw_du_plane_atomic_set_property(struct drm_plane *plane,
+				 struct drm_plane_state *state,
+				 struct drm_property *property,
+				 uint64_t val)
+{
+	struct vmw_private *dev_priv = vmw_priv(plane->dev);
+	struct vmw_plane_state *vps = vmw_plane_state_to_vps(state);
+	struct drm_property_blob *blob = NULL;
+
+	if (property != dev_priv->damage_clips_property)
+		return -EINVAL;
+
+	if (val) {
+		blob = drm_property_lookup_blob(plane->dev, val);
+		if (!blob)
+			return -EINVAL;
+
+		if (blob->length % sizeof(struct drm_vmw_rect) != 0) {
+			drm_property_blob_put(blob);
+			return -EINVAL;
+		}
+	}
+
+	drm_property_blob_put(vps->damage_clips);
+	vps->damage_clips = blob;
+
+	return 0;
+}
+
+
+/**
+ * vmw_du_plane_atomic_get_property - Atomic version of get property
+ *
+ * @plane: drm plane
+ * @state: plane state to query
+ * @property: the property to get
+ * @val: returns the property value
+ *
+ * Returns:
+ * Zero on success, negative errno on failure.
+ */
+int
+vmw_du_plane_atomic_get_property(struct drm_plane *plane,
+				 const struct drm_plane_state *state,
+				 struct drm_property *property,
+				 uint64_t *val)
+{
+	struct vmw_private *dev_priv = vmw_priv(plane->dev);
+	struct vmw_plane_state *vps = vmw_plane_state_to_vps(state);
+
+	if (property == dev_priv->damage_clips_property)
+		*val = (vps->damage_clips) ? vps->damage_clips->base.id : 0;
+	else {
+		DRM_ERROR("Invalid Property %s\n", property->name);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+
+/**
+ * vmw_du_plane_damage - Compute the framebuffer region to update for a
+ * primary plane commit.
+ *
+ * @plane: The primary plane. Its state is the state being committed.
+ * @old_state: The plane state being replaced.
+ * @full: Clip rect covering the visible part of the framebuffer.
+ * @clips: Array of VMW_DAMAGE_MAX_CLIPS clip rects to fill in.
+ * @force_full: Whether the display contents can't be relied upon, for
+ * example because a new display surface was bound.
+ *
+ * Damage clips set through the damage_clips property are clipped to @full.
+ * Clips that don't fit in @clips are merged into the last one. If no damage
+ * was set for this commit, if the display was reconfigured or if the last
+ * update of this display unit failed, @clips will instead hold only @full.
+ *
+ * Returns the number of clip rects in @clips, which is zero if no visible
+ * region was damaged.
+ */
+unsigned int vmw_du_plane_damage(struct drm_plane *plane,
+				 struct drm_plane_state *old_state,
+				 const struct drm_vmw_rect *full,
+				 struct drm_vmw_rect *clips,
+				 bool force_full)
+{
+	struct drm_plane_state *state = plane->state;
+	struct vmw_plane_state *vps = vmw_plane_state_to_vps(state);
+	struct vmw_display_unit *du = vmw_crtc_to_du(state->crtc);
+	const struct drm_vmw_rect *damage;
+	unsigned int i, num_damage, num_clips = 0;
+
+	if (!vps->damage_clips || force_full || du->damage_full ||
+	    !old_state->fb || old_state->crtc != state->crtc ||
+	    old_state->src_x != state->src_x ||
+	    old_state->src_y != state->src_y ||
+	    old_state->src_w != state->src_w ||
+	    old_state->src_h != state->src_h ||
+	    drm_atomic_crtc_needs_modeset(state->crtc->state)) {
+		clips[0] = *full;
+		return 1;
+	}
+
+	damage = vps->damage_clips->data;
+	num_damage = vps->damage_clips->length / sizeof(*damage);
+
+	for (i = 0; i < num_damage; ++i) {
+		s64 x1 = max_t(s64, damage[i].x, full->x);
+		s64 y1 = max_t(s64, damage[i].y, full->y);
+		s64 x2 = min_t(s64, (s64) damage[i].x + damage[i].w,
+			       (s64) full->x + full->w);
+		s64 y2 = min_t(s64, (s64) damage[i].y + damage[i].h,
+			       (s64) full->y + full->h);
+		struct drm_vmw_rect *clip;
+
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		if (num_clips < VMW_DAMAGE_MAX_CLIPS) {
+			clip = &clips[num_clips++];
+			clip->x = x1;
+			clip->y = y1;
+			clip->w = x2 - x1;
+			clip->h = y2 - y1;
+			continue;
+		}
+
+		clip = &clips[VMW_DAMAGE_MAX_CLIPS - 1];
+		x1 = min_t(s64, x1, clip->x);
+		y1 = min_t(s64, y1, clip->y);
+		x2 = max_t(s64, x2, (s64) clip->x + clip->w);
+		y2 = max_t(s64, y2, (s64) clip->y + clip->h);
+		clip->x = x1;
+		clip->y = y1;
+		clip->w = x2 - x1;
+		clip->h = y2 - y1;
+	}
+
+	return num_clips;
+}
+
+
 /**
  * vmw_du_connector_duplicate_state - duplicate connector state
  * @connector: DRM connector
@@ -901,6 +1116,7 @@ static int vmw_framebuffer_surface_dirty(struct drm_framebuffer *framebuffer,
 		return -EINVAL;
 
 	drm_modeset_lock_all(dev_priv->dev);
+	vmw_kms_wait_for_commits(dev_priv->dev);
 
 	ret = ttm_read_lock(&dev_priv->reservation_sem, true);
 	if (unlikely(ret != 0)) {
@@ -922,11 +1138,13 @@ static int vmw_framebuffer_surface_dirty(struct drm_framebuffer *framebuffer,
 	if (dev_priv->active_display_unit == vmw_du_screen_object)
 		ret = vmw_kms_sou_do_surface_dirty(dev_priv, &vfbs->base,
 						   clips, NULL, NULL, 0, 0,
-						   num_clips, inc, NULL, NULL);
+						   num_clips, inc, NULL, NULL,
+						   NULL);
 	else
 		ret = vmw_kms_stdu_surface_dirty(dev_priv, &vfbs->base,
 						 clips, NULL, NULL, 0, 0,
-						 num_clips, inc, NULL, NULL);
+						 num_clips, inc, NULL, NULL,
+						 NULL);
 
 	vmw_fifo_flush(dev_priv, false);
 	ttm_read_unlock(&dev_priv->reservation_sem);
@@ -967,7 +1185,7 @@ int vmw_kms_readback(struct vmw_private *dev_priv,
 	case vmw_du_screen_target:
 		return vmw_kms_stdu_dma(dev_priv, file_priv, vfb,
 					user_fence_rep, NULL, vclips, num_clips,
-					1, false, true, NULL);
+					1, false, true, NULL, NULL);
 	default:
 		WARN_ONCE(true,
 			  "Readback called with invalid display system.\n");
@@ -1103,6 +1321,7 @@ static int vmw_framebuffer_bo_dirty(struct drm_framebuffer *framebuffer,
 	int ret, increment = 1;
 
 	drm_modeset_lock_all(dev_priv->dev);
+	vmw_kms_wait_for_commits(dev_priv->dev);
 
 	ret = ttm_read_lock(&dev_priv->reservation_sem, true);
 	if (unlikely(ret != 0)) {
@@ -1125,12 +1344,13 @@ static int vmw_framebuffer_bo_dirty(struct drm_framebuffer *framebuffer,
 	case vmw_du_screen_target:
 		ret = vmw_kms_stdu_dma(dev_priv, NULL, &vfbd->base, NULL,
 				       clips, NULL, num_clips, increment,
-				       true, true, NULL);
+				       true, true, NULL, NULL);
 		break;
 	case vmw_du_screen_object:
 		ret = vmw_kms_sou_do_bo_dirty(dev_priv, &vfbd->base,
 					      clips, NULL, num_clips,
-					      increment, true, NULL, NULL);
+					      increment, true, NULL, NULL,
+					      NULL);
 		break;
 	case vmw_du_legacy:
 		ret = vmw_kms_ldu_do_bo_dirty(dev_priv, &vfbd->base, 0, 0,
@@ -1739,12 +1959,254 @@ vmw_kms_atomic_check_modeset(struct drm_device *dev,
 	return ret;
 }
 
+/**
+ * vmw_kms_commit_events - Queue the vblank events of a commit
+ *
+ * @dev_priv: Pointer to a device private struct.
+ * @old_state: The atomic state being committed.
+ * @ctx: The validation context of the commit, or NULL if the display units
+ * fenced their own updates.
+ *
+ * Rather than having each display unit fence and flush its own plane
+ * update, a single fence is emitted after the commands of all display
+ * units. It fences the buffers validated for the commit, all vblank events
+ * of the commit are queued on it, and emitting it flushes the commands.
+ * Events that can't be queued are sent right away.
+ *
+ * With flip_on_vblank set, the events are instead sent at the next emulated
+ * vblank, for clients that pace themselves on vblank timing.
+ */
+static void vmw_kms_commit_events(struct vmw_private *dev_priv,
+				  struct drm_atomic_state *old_state,
+				  struct vmw_validation_context *ctx)
+{
+	struct drm_crtc_state *new_crtc_state;
+	struct vmw_fence_obj *fence = NULL;
+	struct drm_crtc *crtc;
+	bool events = false;
+	int i, ret;
+
+	for_each_new_crtc_in_state(old_state, crtc, new_crtc_state, i)
+		events |= (new_crtc_state->event != NULL);
+
+	if (!events && !ctx) {
+		(void) vmw_fifo_flush(dev_priv, false);
+		return;
+	}
+
+	/* If fence is NULL, then already sync. */
+	(void) vmw_execbuf_fence_commands(NULL, dev_priv, &fence, NULL);
+	if (ctx)
+		vmw_validation_done(ctx, fence);
+
+	for_each_new_crtc_in_state(old_state, crtc, new_crtc_state, i) {
+		struct drm_pending_vblank_event *event = new_crtc_state->event;
+
+		if (!event)
+			continue;
+
+		new_crtc_state->event = NULL;
+		if (dev_priv->flip_on_vblank &&
+		    drm_crtc_vblank_get(crtc) == 0) {
+			spin_lock_irq(&crtc->dev->event_lock);
+			drm_crtc_arm_vblank_event(crtc, event);
+			spin_unlock_irq(&crtc->dev->event_lock);
+			continue;
+		}
+
+		if (fence) {
+			ret = vmw_event_fence_action_queue(event->base.file_priv,
+							   fence,
+							   &event->base,
+							   &event->event.tv_sec,
+							   &event->event.tv_usec,
+							   true);
+			if (!ret)
+				continue;
+
+			DRM_ERROR("Failed to queue event on fence.\n");
+		}
+
+		spin_lock_irq(&crtc->dev->event_lock);
+		drm_crtc_send_vblank_event(crtc, event);
+		spin_unlock_irq(&crtc->dev->event_lock);
+	}
+
+	if (fence)
+		vmw_fence_obj_unreference(&fence);
+}
+
+/**
+ * vmw_kms_commit_validate - Validate the framebuffers of a commit
+ *
+ * @dev_priv: Pointer to a device private struct.
+ * @old_state: The atomic state being committed.
+ * @ctx: The validation context of the commit.
+ *
+ * Reserves and validates the framebuffers of all primary planes of the
+ * commit in a single validation context, which the plane updates use
+ * instead of validating and fencing on their own. The context is fenced
+ * and released by vmw_kms_commit_events().
+ *
+ * Returns true if the context was prepared. Otherwise the display units
+ * validate their updates themselves.
+ */
+static bool vmw_kms_commit_validate(struct vmw_private *dev_priv,
+				    struct drm_atomic_state *old_state,
+				    struct vmw_validation_context *ctx)
+{
+	bool cpu_blit = (dev_priv->active_display_unit ==
+			 vmw_du_screen_target &&
+			 !(dev_priv->capabilities & SVGA_CAP_3D));
+	struct drm_plane_state *new_plane_state;
+	struct vmw_framebuffer *vfb;
+	struct drm_plane *plane;
+	bool has_res = false;
+	int i, ret = 0;
+
+	if (dev_priv->active_display_unit == vmw_du_legacy)
+		return false;
+
+	for_each_new_plane_in_state(old_state, plane, new_plane_state, i) {
+		if (plane->type != DRM_PLANE_TYPE_PRIMARY ||
+		    !new_plane_state->crtc || !new_plane_state->fb)
+			continue;
+
+		vfb = vmw_framebuffer_to_vfb(new_plane_state->fb);
+		if (vfb->bo) {
+			ret = vmw_validation_add_bo
+				(ctx, container_of(vfb, struct vmw_framebuffer_bo,
+						   base)->buffer,
+				 false, cpu_blit);
+		} else {
+			ret = vmw_validation_add_resource
+				(ctx, &container_of(vfb,
+						    struct vmw_framebuffer_surface,
+						    base)->surface->res,
+				 0, NULL, NULL);
+			has_res = true;
+		}
+		if (ret)
+			goto out_unref;
+	}
+
+	if (!has_res && !vmw_validation_has_bos(ctx))
+		return false;
+
+	ret = vmw_validation_prepare(ctx, has_res ? &dev_priv->cmdbuf_mutex :
+				     NULL, false);
+	if (ret)
+		goto out_unref;
+
+	for_each_new_plane_in_state(old_state, plane, new_plane_state, i)
+		vmw_plane_state_to_vps(new_plane_state)->val_ctx = ctx;
+
+	return true;
+
+out_unref:
+	vmw_validation_unref_lists(ctx);
+	return false;
+}
+
+/**
+ * vmw_kms_atomic_commit_tail - Commit an atomic state to the device
+ *
+ * @old_state: The atomic state being committed.
+ *
+ * Like drm_atomic_helper_commit_tail(), but with the validation, fencing,
+ * vblank events and command flushing of all display units batched per
+ * commit.
+ *
+ * For nonblocking commits this runs from the commit worker without the
+ * modeset locks held, so the plane updates, including the CPU blit of
+ * 2D VMs, don't stall the caller. The vblank events then signal once the
+ * device has processed the update.
+ */
+static void vmw_kms_atomic_commit_tail(struct drm_atomic_state *old_state)
+{
+	struct drm_device *dev = old_state->dev;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct drm_plane_state *new_plane_state;
+	struct drm_plane *plane;
+	DECLARE_VAL_CONTEXT(val_ctx, NULL, 1);
+	bool validated;
+	int i;
+
+	drm_atomic_helper_commit_modeset_disables(dev, old_state);
+
+	validated = vmw_kms_commit_validate(dev_priv, old_state, &val_ctx);
+
+	drm_atomic_helper_commit_planes(dev, old_state, 0);
+
+	drm_atomic_helper_commit_modeset_enables(dev, old_state);
+
+	vmw_kms_commit_events(dev_priv, old_state,
+			      validated ? &val_ctx : NULL);
+
+	if (validated) {
+		for_each_new_plane_in_state(old_state, plane, new_plane_state,
+					    i)
+			vmw_plane_state_to_vps(new_plane_state)->val_ctx =
+				NULL;
+	}
+
+	if (dev_priv->active_display_unit == vmw_du_screen_target)
+		vmw_kms_stdu_commit_done(old_state);
+
+	drm_atomic_helper_commit_hw_done(old_state);
+
+	drm_atomic_helper_wait_for_vblanks(dev, old_state);
+
+	drm_atomic_helper_cleanup_planes(dev, old_state);
+}
+
+/**
+ * vmw_kms_wait_for_commits - Wait for pending commits to reach the device
+ *
+ * @dev: Pointer to the drm device.
+ *
+ * Nonblocking commits update the display units from a worker that doesn't
+ * hold the modeset locks. Paths that use display unit state outside of an
+ * atomic commit must call this with all modeset locks held, so that no
+ * commit is still updating that state. New commits can't be swapped in
+ * while the locks are held.
+ */
+void vmw_kms_wait_for_commits(struct drm_device *dev)
+{
+	struct drm_crtc_commit *commit;
+	struct drm_crtc *crtc;
+	long ret;
+
+	drm_for_each_crtc(crtc, dev) {
+		spin_lock(&crtc->commit_lock);
+		commit = list_first_entry_or_null(&crtc->commit_list,
+						  struct drm_crtc_commit,
+						  commit_entry);
+		if (commit)
+			drm_crtc_commit_get(commit);
+		spin_unlock(&crtc->commit_lock);
+
+		if (!commit)
+			continue;
+
+		ret = wait_for_completion_timeout(&commit->hw_done, 10*HZ);
+		if (ret == 0)
+			DRM_ERROR("[CRTC:%d:%s] hw_done timed out\n",
+				  crtc->base.id, crtc->name);
+		drm_crtc_commit_put(commit);
+	}
+}
+
 static const struct drm_mode_config_funcs vmw_kms_funcs = {
 	.fb_create = vmw_kms_fb_create,
 	.atomic_check = vmw_kms_atomic_check_modeset,
 	.atomic_commit = drm_atomic_helper_commit,
 };
 
+static const struct drm_mode_config_helper_funcs vmw_kms_helper_funcs = {
+	.atomic_commit_tail = vmw_kms_atomic_commit_tail,
+};
+
 static int vmw_kms_generic_present(struct vmw_private *dev_priv,
 				   struct drm_file *file_priv,
 				   struct vmw_framebuffer *vfb,
@@ -1756,7 +2218,7 @@ static int vmw_kms_generic_present(struct vmw_private *dev_priv,
 {
 	return vmw_kms_sou_do_surface_dirty(dev_priv, vfb, NULL, clips,
 					    &surface->res, destX, destY,
-					    num_clips, 1, NULL, NULL);
+					    num_clips, 1, NULL, NULL, NULL);
 }
 
 
@@ -1775,7 +2237,8 @@ int vmw_kms_present(struct vmw_private *dev_priv,
 	case vmw_du_screen_target:
 		ret = vmw_kms_stdu_surface_dirty(dev_priv, vfb, NULL, clips,
 						 &surface->res, destX, destY,
-						 num_clips, 1, NULL, NULL);
+						 num_clips, 1, NULL, NULL,
+						 NULL);
 		break;
 	case vmw_du_screen_object:
 		ret = vmw_kms_generic_present(dev_priv, file_priv, vfb, surface,
@@ -1819,6 +2282,7 @@ int vmw_kms_init(struct vmw_private *dev_priv)
 
 	drm_mode_config_init(dev);
 	dev->mode_config.funcs = &vmw_kms_funcs;
+	dev->mode_config.helper_private = &vmw_kms_helper_funcs;
 	dev->mode_config.min_width = 1;
 	dev->mode_config.min_height = 1;
 	dev->mode_config.max_width = dev_priv->texture_max_width;
@@ -2009,8 +2473,58 @@ bool vmw_kms_validate_mode_vram(struct vmw_private *dev_priv,
 }
 
 
+/*
+ * The device has no vblank interrupt. It's emulated with a per display unit
+ * hrtimer that ticks at the refresh rate of the current mode while vblank
+ * interrupts are enabled.
+ */
+#define VMW_VBLANK_DEFAULT_NS (NSEC_PER_SEC / 60)
+
+/*
+ * The frame duration is computed by the DRM core for the current mode, and
+ * is zero until a mode has been set.
+ */
+static ktime_t vmw_du_vblank_period(struct vmw_display_unit *du)
+{
+	struct drm_crtc *crtc = &du->crtc;
+	struct drm_vblank_crtc *vblank =
+		&crtc->dev->vblank[drm_crtc_index(crtc)];
+	int framedur_ns = READ_ONCE(vblank->framedur_ns);
+
+	return ns_to_ktime(framedur_ns > 0 ? framedur_ns :
+			   VMW_VBLANK_DEFAULT_NS);
+}
+
+static enum hrtimer_restart vmw_du_vblank_timer_fn(struct hrtimer *timer)
+{
+	struct vmw_display_unit *du =
+		container_of(timer, struct vmw_display_unit, vblank_timer);
+
+	if (!READ_ONCE(du->vblank_enabled))
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, vmw_du_vblank_period(du));
+	drm_crtc_handle_vblank(&du->crtc);
+
+	return HRTIMER_RESTART;
+}
+
+/**
+ * vmw_du_vblank_init - Set up vblank emulation for a display unit
+ *
+ * @du: The display unit.
+ */
+void vmw_du_vblank_init(struct vmw_display_unit *du)
+{
+	hrtimer_init(&du->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	du->vblank_timer.function = vmw_du_vblank_timer_fn;
+}
+
 /**
  * Function called by DRM code called with vbl_lock held.
+ *
+ * There is no hardware counter. With max_vblank_count zero, the DRM core
+ * counts the emulated vblank interrupts instead.
  */
 u32 vmw_get_vblank_counter(struct drm_device *dev, unsigned int pipe)
 {
@@ -2022,14 +2536,37 @@ u32 vmw_get_vblank_counter(struct drm_device *dev, unsigned int pipe)
  */
 int vmw_enable_vblank(struct drm_device *dev, unsigned int pipe)
 {
-	return -EINVAL;
+	struct drm_crtc *crtc = drm_crtc_from_index(dev, pipe);
+	struct vmw_display_unit *du;
+
+	if (!crtc)
+		return -EINVAL;
+
+	du = vmw_crtc_to_du(crtc);
+	WRITE_ONCE(du->vblank_enabled, true);
+	hrtimer_start(&du->vblank_timer, vmw_du_vblank_period(du),
+		      HRTIMER_MODE_REL);
+
+	return 0;
 }
 
 /**
  * Function called by DRM code called with vbl_lock held.
+ *
+ * The timer callback may be spinning on a DRM vblank lock, so it's not
+ * waited for. It stops by itself once it sees vblank disabled.
  */
 void vmw_disable_vblank(struct drm_device *dev, unsigned int pipe)
 {
+	struct drm_crtc *crtc = drm_crtc_from_index(dev, pipe);
+	struct vmw_display_unit *du;
+
+	if (!crtc)
+		return;
+
+	du = vmw_crtc_to_du(crtc);
+	WRITE_ONCE(du->vblank_enabled, false);
+	hrtimer_try_to_cancel(&du->vblank_timer);
 }
 
 /**
@@ -2899,6 +3436,26 @@ vmw_kms_create_implicit_placement_property(struct vmw_private *dev_priv,
 }
 
 
+/**
+ * vmw_kms_create_damage_clips_property - Set up the damage clips property.
+ *
+ * @dev_priv: Pointer to a device private struct.
+ *
+ * Sets up the primary plane damage clips property unless it's already set
+ * up. The property is a blob of struct drm_vmw_rect.
+ */
+void
+vmw_kms_create_damage_clips_property(struct vmw_private *dev_priv)
+{
+	if (dev_priv->damage_clips_property)
+		return;
+
+	dev_priv->damage_clips_property =
+		drm_property_create(dev_priv->dev, DRM_MODE_PROP_BLOB,
+				    "damage_clips", 0);
+}
+
+
 /**
  * vmw_kms_set_config - Wrapper around drm_atomic_helper_set_config
  *
@@ -28,6 +28,7 @@
 #ifndef VMWGFX_KMS_H_
 #define VMWGFX_KMS_H_
 
+#include <linux/hrtimer.h>
 #include "drmP.h"
 #include "drm_crtc_helper.h"
 #include "vmwgfx_drv.h"
@@ -141,6 +142,9 @@ static const uint32_t vmw_cursor_plane_formats[] = {
 };
 
 
+/* Damage clips beyond this number are merged into the last clip rect. */
+#define VMW_DAMAGE_MAX_CLIPS 16
+
 #define vmw_crtc_state_to_vcs(x) container_of(x, struct vmw_crtc_state, base)
 #define vmw_plane_state_to_vps(x) container_of(x, struct vmw_plane_state, base)
 #define vmw_connector_state_to_vcs(x) \
@@ -164,11 +168,16 @@ struct vmw_crtc_state {
  * @content_fb_type Used by STDU.
  * @bo_size Size of the bo, used by Screen Object Display Unit
  * @pinned pin count for STDU display surface
+ * @damage_clips damage_clips property blob for this commit, or NULL
+ * @val_ctx Validation context shared by the display units of a commit, or
+ * NULL. Only set during the commit tail.
  */
 struct vmw_plane_state {
 	struct drm_plane_state base;
 	struct vmw_surface *surf;
 	struct vmw_buffer_object *bo;
+	struct drm_property_blob *damage_clips;
+	struct vmw_validation_context *val_ctx;
 
 	int content_fb_type;
 	unsigned long bo_size;
@@ -256,6 +265,18 @@ struct vmw_display_unit {
 	bool active_implicit;
 	int set_gui_x;
 	int set_gui_y;
+
+	/*
+	 * Set when the last plane update failed, so that the next one
+	 * can't rely on damage clips.
+	 */
+	bool damage_full;
+
+	/*
+	 * Vblank interrupt emulation, at the refresh rate of the mode.
+	 */
+	struct hrtimer vblank_timer;
+	bool vblank_enabled;
 };
 
 struct vmw_validation_ctx {
@@ -273,6 +294,7 @@ struct vmw_validation_ctx {
  * Shared display unit functions - vmwgfx_kms.c
  */
 void vmw_du_cleanup(struct vmw_display_unit *du);
+void vmw_du_vblank_init(struct vmw_display_unit *du);
 void vmw_du_crtc_save(struct drm_crtc *crtc);
 void vmw_du_crtc_restore(struct drm_crtc *crtc);
 int vmw_du_crtc_gamma_set(struct drm_crtc *crtc,
@@ -344,6 +366,8 @@ void vmw_kms_update_implicit_fb(struct vmw_private *dev_priv,
 				struct drm_crtc *crtc);
 void vmw_kms_create_implicit_placement_property(struct vmw_private *dev_priv,
 						bool immutable);
+void vmw_kms_create_damage_clips_property(struct vmw_private *dev_priv);
+void vmw_kms_wait_for_commits(struct drm_device *dev);
 
 /* Universal Plane Helpers */
 void vmw_du_primary_plane_destroy(struct drm_plane *plane);
@@ -366,6 +390,19 @@ void vmw_du_plane_destroy_state(struct drm_plane *plane,
 				struct drm_plane_state *state);
 void vmw_du_plane_unpin_surf(struct vmw_plane_state *vps,
 			     bool unreference);
+int vmw_du_plane_atomic_set_property(struct drm_plane *plane,
+				     struct drm_plane_state *state,
+				     struct drm_property *property,
+				     uint64_t val);
+int vmw_du_plane_atomic_get_property(struct drm_plane *plane,
+				     const struct drm_plane_state *state,
+				     struct drm_property *property,
+				     uint64_t *val);
+unsigned int vmw_du_plane_damage(struct drm_plane *plane,
+				 struct drm_plane_state *old_state,
+				 const struct drm_vmw_rect *full,
+				 struct drm_vmw_rect *clips,
+				 bool force_full);
 
 int vmw_du_crtc_atomic_check(struct drm_crtc *crtc,
 			     struct drm_crtc_state *state);
@@ -413,7 +450,8 @@ int vmw_kms_sou_do_surface_dirty(struct vmw_private *dev_priv,
 				 s32 dest_y,
 				 unsigned num_clips, int inc,
 				 struct vmw_fence_obj **out_fence,
-				 struct drm_crtc *crtc);
+				 struct drm_crtc *crtc,
+				 struct vmw_validation_context *commit_ctx);
 int vmw_kms_sou_do_bo_dirty(struct vmw_private *dev_priv,
 			    struct vmw_framebuffer *framebuffer,
 			    struct drm_clip_rect *clips,
@@ -421,7 +459,8 @@ int vmw_kms_sou_do_bo_dirty(struct vmw_private *dev_priv,
 			    unsigned int num_clips, int increment,
 			    bool interruptible,
 			    struct vmw_fence_obj **out_fence,
-			    struct drm_crtc *crtc);
+			    struct drm_crtc *crtc,
+			    struct vmw_validation_context *commit_ctx);
 int vmw_kms_sou_readback(struct vmw_private *dev_priv,
 			 struct drm_file *file_priv,
 			 struct vmw_framebuffer *vfb,
@@ -444,7 +483,8 @@ int vmw_kms_stdu_surface_dirty(struct vmw_private *dev_priv,
 			       s32 dest_y,
 			       unsigned num_clips, int inc,
 			       struct vmw_fence_obj **out_fence,
-			       struct drm_crtc *crtc);
+			       struct drm_crtc *crtc,
+			       struct vmw_validation_context *commit_ctx);
 int vmw_kms_stdu_dma(struct vmw_private *dev_priv,
 		     struct drm_file *file_priv,
 		     struct vmw_framebuffer *vfb,
@@ -455,7 +495,9 @@ int vmw_kms_stdu_dma(struct vmw_private *dev_priv,
 		     int increment,
 		     bool to_surface,
 		     bool interruptible,
-		     struct drm_crtc *crtc);
+		     struct drm_crtc *crtc,
+		     struct vmw_validation_context *commit_ctx);
+void vmw_kms_stdu_commit_done(struct drm_atomic_state *old_state);
 
 int vmw_kms_set_config(struct drm_mode_set *set,
 		       struct drm_modeset_acquire_ctx *ctx);
@@ -215,7 +215,7 @@ static void vmw_ldu_crtc_helper_prepare(struct drm_crtc *crtc)
 }
 
 /**
- * vmw_ldu_crtc_helper_commit - Noop
+ * vmw_ldu_crtc_helper_commit - Turns on vblank for the CRTC
  *
  * @crtc: CRTC associated with the new screen
  *
@@ -226,6 +226,7 @@ static void vmw_ldu_crtc_helper_prepare(struct drm_crtc *crtc)
  */
 static void vmw_ldu_crtc_helper_commit(struct drm_crtc *crtc)
 {
+	drm_crtc_vblank_on(crtc);
 }
 
 /**
@@ -235,6 +236,7 @@ static void vmw_ldu_crtc_helper_commit(struct drm_crtc *crtc)
  */
 static void vmw_ldu_crtc_helper_disable(struct drm_crtc *crtc)
 {
+	drm_crtc_vblank_off(crtc);
 }
 
 static const struct drm_crtc_funcs vmw_legacy_crtc_funcs = {
@@ -413,6 +415,7 @@ static int vmw_ldu_init(struct vmw_private *dev_priv, unsigned unit)
 		return -ENOMEM;
 
 	ldu->base.unit = unit;
+	vmw_du_vblank_init(&ldu->base);
 	crtc = &ldu->base.crtc;
 	encoder = &ldu->base.encoder;
 	connector = &ldu->base.connector;
@@ -90,7 +90,8 @@ static int vmw_mob_pt_populate(struct vmw_private *dev_priv,
 			       struct vmw_mob *mob);
 static void vmw_mob_pt_setup(struct vmw_mob *mob,
 			     struct vmw_piter data_iter,
-			     unsigned long num_data_pages);
+			     unsigned long num_data_pages,
+			     unsigned int ppn_size);
 
 /*
  * vmw_setup_otable_base - Issue an object table base setup command to
@@ -142,8 +143,8 @@ static int vmw_setup_otable_base(struct vmw_private *dev_priv,
 		if (unlikely(ret != 0))
 			goto out_no_populate;
 
-		vmw_mob_pt_setup(mob, iter, otable->size >> PAGE_SHIFT);
-		mob->pt_level += VMW_MOBFMT_PTDEPTH_1 - SVGA3D_MOBFMT_PTDEPTH_1;
+		vmw_mob_pt_setup(mob, iter, otable->size >> PAGE_SHIFT,
+				 VMW_PPN_SIZE);
 	}
 
 	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd));
@@ -465,22 +466,39 @@ out_unreserve:
  *
  * @addr: Pointer to pointer to page table entry.
  * @val: The page table entry
+ * @ppn_size: The page table entry size. 4 or 8.
  *
  * Assigns a value to a page table entry pointed to by *@addr and increments
  * *@addr according to the page table entry size.
  */
-#if (VMW_PPN_SIZE == 8)
-static void vmw_mob_assign_ppn(u32 **addr, dma_addr_t val)
+static void vmw_mob_assign_ppn(u32 **addr, dma_addr_t val,
+			       unsigned int ppn_size)
 {
-	*((u64 *) *addr) = val >> PAGE_SHIFT;
-	*addr += 2;
+	if (ppn_size == 8) {
+		*((u64 *) *addr) = val >> PAGE_SHIFT;
+		*addr += 2;
+	} else {
+		*(*addr)++ = val >> PAGE_SHIFT;
+	}
 }
-#else
-static void vmw_mob_assign_ppn(u32 **addr, dma_addr_t val)
+
+/**
+ * vmw_mob_ppn_size - Select the page table entry size for a mob
+ *
+ * @data: The scatter-gather table of the mob data pages.
+ * @pt: The scatter-gather table of the mob page table pages.
+ *
+ * Page tables with 32-bit entries cover twice the amount of data per
+ * page table page, so use them whenever all page frame numbers the
+ * page table refers to fit in 32 bits.
+ */
+static unsigned int vmw_mob_ppn_size(const struct vmw_sg_table *data,
+				     const struct vmw_sg_table *pt)
 {
-	*(*addr)++ = val >> PAGE_SHIFT;
+	u64 max_pfn = (u64) max(data->max_addr, pt->max_addr) >> PAGE_SHIFT;
+
+	return upper_32_bits(max_pfn) ? VMW_PPN_SIZE : 4;
 }
-#endif
 
 /*
  * vmw_mob_build_pt - Build a pagetable
@@ -489,15 +507,17 @@ static void vmw_mob_assign_ppn(u32 **addr, dma_addr_t val)
  *                  object's data pages.
  * @num_data_pages: Number of buffer object data pages.
  * @pt_pages:       Array of page pointers to the page table pages.
+ * @ppn_size:       Page table entry size.
  *
  * Returns the number of page table pages actually used.
  * Uses atomic kmaps of highmem pages to avoid TLB thrashing.
  */
 static unsigned long vmw_mob_build_pt(struct vmw_piter *data_iter,
 				      unsigned long num_data_pages,
-				      struct vmw_piter *pt_iter)
+				      struct vmw_piter *pt_iter,
+				      unsigned int ppn_size)
 {
-	unsigned long pt_size = num_data_pages * VMW_PPN_SIZE;
+	unsigned long pt_size = num_data_pages * ppn_size;
 	unsigned long num_pt_pages = DIV_ROUND_UP(pt_size, PAGE_SIZE);
 	unsigned long pt_page;
 	u32 *addr, *save_addr;
@@ -509,9 +529,10 @@ static unsigned long vmw_mob_build_pt(struct vmw_piter *data_iter,
 
 		save_addr = addr = kmap_atomic(page);
 
-		for (i = 0; i < PAGE_SIZE / VMW_PPN_SIZE; ++i) {
+		for (i = 0; i < PAGE_SIZE / ppn_size; ++i) {
 			vmw_mob_assign_ppn(&addr,
-					   vmw_piter_dma_addr(data_iter));
+					   vmw_piter_dma_addr(data_iter),
+					   ppn_size);
 			if (unlikely(--num_data_pages == 0))
 				break;
 			WARN_ON(!vmw_piter_next(data_iter));
@@ -530,12 +551,15 @@ static unsigned long vmw_mob_build_pt(struct vmw_piter *data_iter,
  * @data_addr       Array of DMA addresses to the buffer object's data
  *                  pages.
  * @num_data_pages: Number of buffer object data pages.
+ * @ppn_size:       Page table entry size.
  *
  * Uses tail recursion to set up a multilevel mob page table.
+ * On return, @mob->pt_level holds the device page table format.
  */
 static void vmw_mob_pt_setup(struct vmw_mob *mob,
 			     struct vmw_piter data_iter,
-			     unsigned long num_data_pages)
+			     unsigned long num_data_pages,
+			     unsigned int ppn_size)
 {
 	unsigned long num_pt_pages = 0;
 	struct ttm_buffer_object *bo = mob->pt_bo;
@@ -556,11 +580,14 @@ static void vmw_mob_pt_setup(struct vmw_mob *mob,
 		BUG_ON(mob->pt_level > 2);
 		save_pt_iter = pt_iter;
 		num_pt_pages = vmw_mob_build_pt(&data_iter, num_data_pages,
-						&pt_iter);
+						&pt_iter, ppn_size);
 		data_iter = save_pt_iter;
 		num_data_pages = num_pt_pages;
 	}
 
+	if (ppn_size == 8)
+		mob->pt_level += SVGA3D_MOBFMT_PTDEPTH64_1 -
+			SVGA3D_MOBFMT_PTDEPTH_1;
 	mob->pt_root_page = vmw_piter_dma_addr(&save_pt_iter);
 	ttm_bo_unreserve(bo);
 }
@@ -663,9 +690,10 @@ int vmw_mob_bind(struct vmw_private *dev_priv,
 		if (unlikely(ret != 0))
 			return ret;
 
-		vmw_mob_pt_setup(mob, data_iter, num_data_pages);
+		vmw_mob_pt_setup(mob, data_iter, num_data_pages,
+				 vmw_mob_ppn_size(vsgt,
+						  vmw_bo_sg_table(mob->pt_bo)));
 		pt_set_up = true;
-		mob->pt_level += VMW_MOBFMT_PTDEPTH_1 - SVGA3D_MOBFMT_PTDEPTH_1;
 	}
 
 	vmw_fifo_resource_inc(dev_priv);
@@ -0,0 +1,647 @@
+// SPDX-License-Identifier: GPL-2.0 OR MIT
+/**************************************************************************
+ *
+ * Copyright © 2018 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "vmwgfx_drv.h"
+
+/*
+ * Command submissions depending on fences that haven't signaled yet are
+ * copied into a job and queued on the submitting file's scheduling entity,
+ * so that the submitting thread never blocks. The entity work item submits
+ * the jobs in order, each one once all its dependencies have signaled.
+ * Each job carries a finished fence which signals when the device fence of
+ * the submitted commands signals. That fence is what user-space sees, in
+ * the form of a sync_file or a timeline point.
+ *
+ * Device fences are never dependencies, since the device executes command
+ * buffers in submission order.
+ */
+
+/**
+ * struct vmw_sched_job - A deferred command submission
+ *
+ * @base: The finished fence. Must be the first member, since the job is
+ * freed together with the fence.
+ * @lock: The finished fence lock.
+ * @head: List head for the entity's job list.
+ * @entity: The entity the job is queued on.
+ * @deps: Array of referenced dependency fences.
+ * @num_deps: Number of entries in @deps.
+ * @max_deps: Allocated size of @deps.
+ * @cur_dep: Index of the first dependency not known to have signaled.
+ * @cb_fence: Referenced pointer to the fence @cb was last added to.
+ * @cb: Fence callback for the dependency currently waited for.
+ * @wait_tl: Referenced pointer to a timeline to wait for, or NULL.
+ * @wait_point: The point of @wait_tl to wait for.
+ * @tl_cb: Callback for the submission of @wait_point.
+ * @waiting: A callback is pending. Protected by the entity lock.
+ * @commands: The command batch.
+ * @command_size: Size of the command batch.
+ * @context_handle: The DX context handle of the command batch.
+ * @hw_fence: The device fence of the submitted command batch.
+ * @action: Fence action signaling @base when @hw_fence signals.
+ */
+struct vmw_sched_job {
+	struct dma_fence base;
+	spinlock_t lock;
+	struct list_head head;
+	struct vmw_sched_entity *entity;
+	struct dma_fence **deps;
+	unsigned int num_deps;
+	unsigned int max_deps;
+	unsigned int cur_dep;
+	struct dma_fence *cb_fence;
+	struct dma_fence_cb cb;
+	struct vmw_timeline *wait_tl;
+	u64 wait_point;
+	struct vmw_timeline_cb tl_cb;
+	bool waiting;
+	void *commands;
+	u32 command_size;
+	u32 context_handle;
+	struct vmw_fence_obj *hw_fence;
+	struct vmw_fence_action action;
+};
+
+static const char *vmw_sched_get_driver_name(struct dma_fence *f)
+{
+	return "vmwgfx";
+}
+
+static const char *vmw_sched_get_timeline_name(struct dma_fence *f)
+{
+	return "vmwgfx-sched";
+}
+
+static bool vmw_sched_enable_signaling(struct dma_fence *f)
+{
+	/* The fence action signals the fence. */
+	return true;
+}
+
+static const struct dma_fence_ops vmw_sched_fence_ops = {
+	.get_driver_name = vmw_sched_get_driver_name,
+	.get_timeline_name = vmw_sched_get_timeline_name,
+	.enable_signaling = vmw_sched_enable_signaling,
+	.wait = dma_fence_default_wait,
+};
+
+/**
+ * vmw_sched_job_fini - Release the job's resources
+ *
+ * @job: The job.
+ *
+ * Releases everything but the finished fence. Must be called from process
+ * context.
+ */
+static void vmw_sched_job_fini(struct vmw_sched_job *job)
+{
+	unsigned int i;
+
+	for (i = 0; i < job->num_deps; ++i)
+		dma_fence_put(job->deps[i]);
+	kfree(job->deps);
+	job->deps = NULL;
+	job->num_deps = 0;
+
+	dma_fence_put(job->cb_fence);
+	job->cb_fence = NULL;
+
+	if (job->wait_tl)
+		vmw_timeline_unreference(&job->wait_tl);
+
+	drm_free_large(job->commands);
+	job->commands = NULL;
+}
+
+static void vmw_sched_job_cancel(struct vmw_sched_job *job, int error)
+{
+	vmw_sched_job_fini(job);
+	dma_fence_set_error(&job->base, error);
+	dma_fence_signal(&job->base);
+}
+
+static void vmw_sched_job_set_waiting(struct vmw_sched_job *job, bool waiting)
+{
+	spin_lock_irq(&job->entity->lock);
+	job->waiting = waiting;
+	spin_unlock_irq(&job->entity->lock);
+}
+
+/**
+ * vmw_sched_job_wake - Requeue the entity work after a dependency signaled
+ *
+ * @job: The job.
+ *
+ * May be called from irq context.
+ */
+static void vmw_sched_job_wake(struct vmw_sched_job *job)
+{
+	struct vmw_sched_entity *entity = job->entity;
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&entity->lock, irq_flags);
+	job->waiting = false;
+	if (!entity->closed)
+		(void) queue_work(entity->dev_priv->sched_wq, &entity->work);
+	spin_unlock_irqrestore(&entity->lock, irq_flags);
+}
+
+static void vmw_sched_fence_cb(struct dma_fence *f, struct dma_fence_cb *cb)
+{
+	vmw_sched_job_wake(container_of(cb, struct vmw_sched_job, cb));
+}
+
+static void vmw_sched_timeline_cb(struct vmw_timeline_cb *cb)
+{
+	vmw_sched_job_wake(container_of(cb, struct vmw_sched_job, tl_cb));
+}
+
+/**
+ * vmw_sched_job_wait_fence - Add a callback to a dependency fence
+ *
+ * @job: The job.
+ * @fence: The dependency fence.
+ *
+ * Returns true if the callback was added, false if @fence has already
+ * signaled.
+ */
+static bool vmw_sched_job_wait_fence(struct vmw_sched_job *job,
+				     struct dma_fence *fence)
+{
+	vmw_sched_job_set_waiting(job, true);
+	if (!dma_fence_add_callback(fence, &job->cb, vmw_sched_fence_cb)) {
+		job->cb_fence = dma_fence_get(fence);
+		return true;
+	}
+
+	vmw_sched_job_set_waiting(job, false);
+	return false;
+}
+
+/**
+ * vmw_sched_job_ready - Check whether all dependencies of a job have signaled
+ *
+ * @job: The job.
+ *
+ * If a dependency hasn't signaled, adds a callback to it that requeues the
+ * entity work, and returns false. Returns true if the job is ready to run.
+ */
+static bool vmw_sched_job_ready(struct vmw_sched_job *job)
+{
+	struct dma_fence *fence;
+	bool wait;
+
+	dma_fence_put(job->cb_fence);
+	job->cb_fence = NULL;
+
+	for (; job->cur_dep < job->num_deps; ++job->cur_dep)
+		if (vmw_sched_job_wait_fence(job, job->deps[job->cur_dep]))
+			return false;
+
+	while (job->wait_tl) {
+		fence = vmw_timeline_next_fence(job->wait_tl, job->wait_point);
+		if (!fence) {
+			vmw_timeline_unreference(&job->wait_tl);
+			break;
+		}
+
+		if (IS_ERR(fence)) {
+			/* Wait for the point to be submitted. */
+			vmw_sched_job_set_waiting(job, true);
+			if (!vmw_timeline_add_submit_cb(job->wait_tl,
+							job->wait_point,
+							&job->tl_cb,
+							vmw_sched_timeline_cb))
+				return false;
+
+			vmw_sched_job_set_waiting(job, false);
+			continue;
+		}
+
+		wait = vmw_sched_job_wait_fence(job, fence);
+		dma_fence_put(fence);
+		if (wait)
+			return false;
+	}
+
+	return true;
+}
+
+static void vmw_sched_job_seq_passed(struct vmw_fence_action *action)
+{
+	struct vmw_sched_job *job =
+		container_of(action, struct vmw_sched_job, action);
+
+	dma_fence_signal(&job->base);
+}
+
+static void vmw_sched_job_cleanup(struct vmw_fence_action *action)
+{
+	struct vmw_sched_job *job =
+		container_of(action, struct vmw_sched_job, action);
+
+	vmw_fence_obj_unreference(&job->hw_fence);
+	dma_fence_put(&job->base);
+}
+
+/**
+ * vmw_sched_job_run - Submit a job to the device
+ *
+ * @job: The job.
+ *
+ * The commands are checked exactly like commands submitted directly from
+ * user-space. On failure, the finished fence is signaled with an error.
+ */
+static void vmw_sched_job_run(struct vmw_sched_job *job)
+{
+	struct vmw_sched_entity *entity = job->entity;
+	struct vmw_private *dev_priv = entity->dev_priv;
+	struct vmw_fence_obj *fence = NULL;
+	int ret;
+
+	ret = ttm_read_lock(&dev_priv->reservation_sem, false);
+	if (likely(ret == 0)) {
+		ret = vmw_execbuf_process(entity->file_priv, dev_priv, NULL,
+					  job->commands, true,
+					  job->command_size, 0,
+					  job->context_handle, NULL, &fence,
+					  0);
+		ttm_read_unlock(&dev_priv->reservation_sem);
+	}
+
+	if (unlikely(ret != 0)) {
+		DRM_ERROR("Deferred command submission failed.\n");
+		vmw_sched_job_cancel(job, ret);
+		return;
+	}
+
+	vmw_sched_job_fini(job);
+	vmw_kms_cursor_post_execbuf(dev_priv);
+
+	/* Fence submission failed. The device is synchronized. */
+	if (!fence) {
+		dma_fence_signal(&job->base);
+		return;
+	}
+
+	job->hw_fence = fence;
+	job->action.type = VMW_ACTION_SCHED;
+	job->action.seq_passed = vmw_sched_job_seq_passed;
+	job->action.cleanup = vmw_sched_job_cleanup;
+	dma_fence_get(&job->base);
+	vmw_fence_obj_add_action(fence, &job->action);
+}
+
+static void vmw_sched_work_func(struct work_struct *work)
+{
+	struct vmw_sched_entity *entity =
+		container_of(work, struct vmw_sched_entity, work);
+	struct vmw_sched_job *job;
+	bool idle;
+
+	for (;;) {
+		spin_lock_irq(&entity->lock);
+		job = list_first_entry_or_null(&entity->jobs,
+					       struct vmw_sched_job, head);
+		if (job && (entity->closed || job->waiting))
+			job = NULL;
+		spin_unlock_irq(&entity->lock);
+
+		if (!job || !vmw_sched_job_ready(job))
+			return;
+
+		vmw_sched_job_run(job);
+
+		spin_lock_irq(&entity->lock);
+		list_del_init(&job->head);
+		idle = list_empty(&entity->jobs);
+		spin_unlock_irq(&entity->lock);
+
+		if (idle)
+			wake_up_all(&entity->idle_queue);
+		dma_fence_put(&job->base);
+	}
+}
+
+/**
+ * vmw_sched_entity_init - Initialize a scheduling entity
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @file_priv: The file the entity belongs to.
+ * @entity: The entity to initialize.
+ */
+void vmw_sched_entity_init(struct vmw_private *dev_priv,
+			   struct drm_file *file_priv,
+			   struct vmw_sched_entity *entity)
+{
+	spin_lock_init(&entity->lock);
+	INIT_LIST_HEAD(&entity->jobs);
+	INIT_WORK(&entity->work, vmw_sched_work_func);
+	entity->dev_priv = dev_priv;
+	entity->file_priv = file_priv;
+	entity->context = dma_fence_context_alloc(1);
+	entity->seqno = 0;
+	entity->closed = false;
+	init_waitqueue_head(&entity->idle_queue);
+}
+
+/**
+ * vmw_sched_entity_fini - Take down a scheduling entity
+ *
+ * @entity: The entity.
+ *
+ * Called when the file is closed. Jobs not yet submitted are cancelled,
+ * and their finished fences are signaled with -ECANCELED.
+ */
+void vmw_sched_entity_fini(struct vmw_sched_entity *entity)
+{
+	struct vmw_sched_job *job, *next;
+	LIST_HEAD(jobs);
+
+	spin_lock_irq(&entity->lock);
+	entity->closed = true;
+	spin_unlock_irq(&entity->lock);
+
+	cancel_work_sync(&entity->work);
+
+	spin_lock_irq(&entity->lock);
+	list_splice_init(&entity->jobs, &jobs);
+	spin_unlock_irq(&entity->lock);
+
+	list_for_each_entry_safe(job, next, &jobs, head) {
+		list_del_init(&job->head);
+		if (job->cb_fence)
+			(void) dma_fence_remove_callback(job->cb_fence,
+							 &job->cb);
+		if (job->wait_tl)
+			(void) vmw_timeline_remove_submit_cb(job->wait_tl,
+							     &job->tl_cb);
+		vmw_sched_job_cancel(job, -ECANCELED);
+		dma_fence_put(&job->base);
+	}
+}
+
+/**
+ * vmw_sched_entity_idle - Check whether an entity has queued jobs
+ *
+ * @entity: The entity.
+ *
+ * Returns true if no jobs are queued.
+ */
+bool vmw_sched_entity_idle(struct vmw_sched_entity *entity)
+{
+	bool idle;
+
+	spin_lock_irq(&entity->lock);
+	idle = list_empty(&entity->jobs);
+	spin_unlock_irq(&entity->lock);
+
+	return idle;
+}
+
+/**
+ * vmw_sched_entity_flush - Wait for all queued jobs to be submitted
+ *
+ * @entity: The entity.
+ * @interruptible: Whether to wait interruptibly.
+ *
+ * Returns 0 on success, -ERESTARTSYS if interrupted.
+ */
+int vmw_sched_entity_flush(struct vmw_sched_entity *entity,
+			   bool interruptible)
+{
+	if (interruptible)
+		return wait_event_interruptible(entity->idle_queue,
+						vmw_sched_entity_idle(entity));
+
+	wait_event(entity->idle_queue, vmw_sched_entity_idle(entity));
+	return 0;
+}
+
+/**
+ * vmw_sched_job_create - Create a job
+ *
+ * @entity: The entity the job is to be queued on.
+ *
+ * Returns a pointer to the new job, or an error pointer on failure.
+ * The job should either be queued using vmw_sched_job_push() or freed
+ * using vmw_sched_job_discard().
+ */
+struct vmw_sched_job *vmw_sched_job_create(struct vmw_sched_entity *entity)
+{
+	struct vmw_sched_job *job;
+
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&job->lock);
+	INIT_LIST_HEAD(&job->head);
+	INIT_LIST_HEAD(&job->tl_cb.head);
+	job->entity = entity;
+
+	return job;
+}
+
+/**
+ * vmw_sched_job_add_dep - Add a dependency fence to a job
+ *
+ * @job: The job.
+ * @fence: The fence.
+ *
+ * Fence arrays are split up into their components. Fences that have already
+ * signaled, device fences and fences of earlier jobs of the same entity are
+ * ignored, since the job can't execute before them anyway. Only the latest
+ * fence of each fence context is kept.
+ *
+ * Returns 0 on success, -ENOMEM on allocation failure.
+ */
+int vmw_sched_job_add_dep(struct vmw_sched_job *job, struct dma_fence *fence)
+{
+	struct vmw_fence_manager *fman = job->entity->dev_priv->fman;
+	struct dma_fence **deps;
+	unsigned int i;
+	int ret;
+
+	if (dma_fence_is_array(fence)) {
+		struct dma_fence_array *array = to_dma_fence_array(fence);
+
+		for (i = 0; i < array->num_fences; ++i) {
+			ret = vmw_sched_job_add_dep(job, array->fences[i]);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	}
+
+	if (vmw_fence_is_native(fman, fence) ||
+	    fence->context == job->entity->context ||
+	    dma_fence_is_signaled(fence))
+		return 0;
+
+	for (i = 0; i < job->num_deps; ++i) {
+		if (job->deps[i]->context != fence->context)
+			continue;
+
+		if (dma_fence_is_later(fence, job->deps[i])) {
+			dma_fence_put(job->deps[i]);
+			job->deps[i] = dma_fence_get(fence);
+		}
+
+		return 0;
+	}
+
+	if (job->num_deps == job->max_deps) {
+		unsigned int max_deps = max(job->max_deps * 2, 4U);
+
+		deps = krealloc(job->deps, max_deps * sizeof(*deps),
+				GFP_KERNEL);
+		if (!deps)
+			return -ENOMEM;
+
+		job->deps = deps;
+		job->max_deps = max_deps;
+	}
+
+	job->deps[job->num_deps++] = dma_fence_get(fence);
+
+	return 0;
+}
+
+/**
+ * vmw_sched_job_add_timeline_wait - Make a job wait for a timeline point
+ *
+ * @job: The job.
+ * @tl: The timeline. The job takes over the caller's reference.
+ * @point: The point to wait for. The point need not have been submitted.
+ */
+void vmw_sched_job_add_timeline_wait(struct vmw_sched_job *job,
+				     struct vmw_timeline *tl, u64 point)
+{
+	struct dma_fence *fence = vmw_timeline_next_fence(tl, point);
+
+	if (!fence) {
+		vmw_timeline_unreference(&tl);
+		return;
+	}
+
+	if (!IS_ERR(fence))
+		dma_fence_put(fence);
+
+	job->wait_tl = tl;
+	job->wait_point = point;
+}
+
+/**
+ * vmw_sched_job_needed - Check whether a submission needs to be deferred
+ *
+ * @job: The job holding the dependencies of the submission.
+ *
+ * Returns true if the submission has unsignaled dependencies or if earlier
+ * submissions are still queued on the entity. Otherwise the submission can
+ * be performed directly and the job discarded.
+ */
+bool vmw_sched_job_needed(struct vmw_sched_job *job)
+{
+	return job->num_deps != 0 || job->wait_tl ||
+		!vmw_sched_entity_idle(job->entity);
+}
+
+/**
+ * vmw_sched_job_copy_commands - Copy the command batch of a job
+ *
+ * @job: The job.
+ * @user_commands: User-space address of the command batch.
+ * @command_size: Size of the command batch.
+ * @context_handle: The DX context handle of the command batch.
+ *
+ * Returns 0 on success, negative error code on failure.
+ */
+int vmw_sched_job_copy_commands(struct vmw_sched_job *job,
+				void __user *user_commands,
+				u32 command_size,
+				u32 context_handle)
+{
+	if (command_size > SVGA_CB_MAX_SIZE) {
+		DRM_ERROR("Command buffer is too large.\n");
+		return -EINVAL;
+	}
+
+	job->commands = drm_malloc_ab(command_size, 1);
+	if (!job->commands)
+		return -ENOMEM;
+
+	if (copy_from_user(job->commands, user_commands, command_size)) {
+		DRM_ERROR("Failed copying commands.\n");
+		return -EFAULT;
+	}
+
+	job->command_size = command_size;
+	job->context_handle = context_handle;
+
+	return 0;
+}
+
+/**
+ * vmw_sched_job_push - Queue a job on its entity
+ *
+ * @job: The job. Must not be accessed after this call.
+ *
+ * Returns a referenced pointer to the finished fence of the job.
+ */
+struct dma_fence *vmw_sched_job_push(struct vmw_sched_job *job)
+{
+	struct vmw_sched_entity *entity = job->entity;
+
+	spin_lock_irq(&entity->lock);
+	dma_fence_init(&job->base, &vmw_sched_fence_ops, &job->lock,
+		       entity->context, ++entity->seqno);
+	/* Reference held by the job list. */
+	dma_fence_get(&job->base);
+	list_add_tail(&job->head, &entity->jobs);
+	(void) queue_work(entity->dev_priv->sched_wq, &entity->work);
+	spin_unlock_irq(&entity->lock);
+
+	return &job->base;
+}
+
+/**
+ * vmw_sched_job_discard - Free a job that was never queued
+ *
+ * @p_job: Pointer to a pointer to the job. Cleared on return.
+ */
+void vmw_sched_job_discard(struct vmw_sched_job **p_job)
+{
+	struct vmw_sched_job *job = *p_job;
+
+	*p_job = NULL;
+	vmw_sched_job_fini(job);
+	kfree(job);
+}
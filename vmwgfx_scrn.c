@@ -279,7 +279,7 @@ static void vmw_sou_crtc_helper_prepare(struct drm_crtc *crtc)
 }
 
 /**
- * vmw_sou_crtc_helper_commit - Noop
+ * vmw_sou_crtc_helper_commit - Turns on vblank for the CRTC
  *
  * @crtc: CRTC associated with the new screen
  *
@@ -287,6 +287,7 @@ static void vmw_sou_crtc_helper_prepare(struct drm_crtc *crtc)
  */
 static void vmw_sou_crtc_helper_commit(struct drm_crtc *crtc)
 {
+	drm_crtc_vblank_on(crtc);
 }
 
 /**
@@ -306,6 +307,8 @@ static void vmw_sou_crtc_helper_disable(struct drm_crtc *crtc)
 		return;
 	}
 
+	drm_crtc_vblank_off(crtc);
+
 	sou = vmw_crtc_to_sou(crtc);
 	dev_priv = vmw_priv(crtc->dev);
 
@@ -504,30 +507,42 @@ static void
 vmw_sou_primary_plane_atomic_update(struct drm_plane *plane,
 				    struct drm_plane_state *old_state)
 {
+	struct vmw_plane_state *vps = vmw_plane_state_to_vps(plane->state);
 	struct drm_crtc *crtc = plane->state->crtc;
-	struct drm_pending_vblank_event *event = NULL;
-	struct vmw_fence_obj *fence = NULL;
 	int ret;
 
 	if (crtc && plane->state->fb) {
 		struct vmw_private *dev_priv = vmw_priv(crtc->dev);
 		struct vmw_framebuffer *vfb =
 			vmw_framebuffer_to_vfb(plane->state->fb);
-		struct drm_vmw_rect vclips;
+		struct drm_vmw_rect vclips[VMW_DAMAGE_MAX_CLIPS];
+		struct drm_vmw_rect full;
+		unsigned int num_clips;
 
-		vclips.x = crtc->x;
-		vclips.y = crtc->y;
-		vclips.w = crtc->mode.hdisplay;
-		vclips.h = crtc->mode.vdisplay;
+		full.x = crtc->x;
+		full.y = crtc->y;
+		full.w = crtc->mode.hdisplay;
+		full.h = crtc->mode.vdisplay;
 
-		if (vfb->bo)
+		/*
+		 * The screen object keeps its contents until it's redefined
+		 * on a modeset, so only damaged regions need to be blitted.
+		 */
+		num_clips = vmw_du_plane_damage(plane, old_state, &full,
+						vclips, false);
+
+		if (!num_clips)
+			ret = 0;
+		else if (vfb->bo)
 			ret = vmw_kms_sou_do_bo_dirty(dev_priv, vfb, NULL,
-						      &vclips, 1, 1, true,
-						      &fence, crtc);
+						      vclips, num_clips, 1,
+						      true, NULL, crtc,
+						      vps->val_ctx);
 		else
 			ret = vmw_kms_sou_do_surface_dirty(dev_priv, vfb, NULL,
-							   &vclips, NULL, 0, 0,
-							   1, 1, &fence, crtc);
+							   vclips, NULL, 0, 0,
+							   num_clips, 1, NULL,
+							   crtc, vps->val_ctx);
 
 		/*
 		 * We cannot really fail this function, so if we do, then output
@@ -536,6 +551,8 @@ vmw_sou_primary_plane_atomic_update(struct drm_plane *plane,
 		if (ret != 0)
 			DRM_ERROR("Failed to update screen.\n");
 
+		vmw_crtc_to_du(crtc)->damage_full = (ret != 0);
+
 		crtc->primary->fb = plane->state->fb;
 	} else {
 		/*
@@ -547,29 +564,10 @@ vmw_sou_primary_plane_atomic_update(struct drm_plane *plane,
 		return;
 	}
 
-	event = crtc->state->event;
 	/*
-	 * In case of failure and other cases, vblank event will be sent in
-	 * vmw_du_crtc_atomic_flush.
+	 * The vblank event is queued and the commands are flushed in
+	 * vmw_kms_commit_events(), together with other display units.
 	 */
-	if (event && fence) {
-		struct drm_file *file_priv = event->base.file_priv;
-
-		ret = vmw_event_fence_action_queue(file_priv,
-						   fence,
-						   &event->base,
-						   &event->event.tv_sec,
-						   &event->event.tv_usec,
-						   true);
-
-		if (unlikely(ret != 0))
-			DRM_ERROR("Failed to queue event on fence.\n");
-		else
-			crtc->state->event = NULL;
-	}
-
-	if (fence)
-		vmw_fence_obj_unreference(&fence);
 }
 
 
@@ -580,6 +578,8 @@ static const struct drm_plane_funcs vmw_sou_plane_funcs = {
 	.reset = vmw_du_plane_reset,
 	.atomic_duplicate_state = vmw_du_plane_duplicate_state,
 	.atomic_destroy_state = vmw_du_plane_destroy_state,
+	.atomic_set_property = vmw_du_plane_atomic_set_property,
+	.atomic_get_property = vmw_du_plane_atomic_get_property,
 };
 
 static const struct drm_plane_funcs vmw_sou_cursor_funcs = {
@@ -636,6 +636,7 @@ static int vmw_sou_init(struct vmw_private *dev_priv, unsigned unit)
 		return -ENOMEM;
 
 	sou->base.unit = unit;
+	vmw_du_vblank_init(&sou->base);
 	crtc = &sou->base.crtc;
 	encoder = &sou->base.encoder;
 	connector = &sou->base.connector;
@@ -740,6 +741,9 @@ static int vmw_sou_init(struct vmw_private *dev_priv, unsigned unit)
 			(&connector->base,
 			 dev_priv->implicit_placement_property,
 			 sou->base.is_implicit);
+	if (dev_priv->damage_clips_property)
+		drm_object_attach_property(&primary->base,
+					   dev_priv->damage_clips_property, 0);
 
 	return 0;
 
@@ -774,6 +778,7 @@ int vmw_kms_sou_init_display(struct vmw_private *dev_priv)
 		return ret;
 
 	vmw_kms_create_implicit_placement_property(dev_priv, false);
+	vmw_kms_create_damage_clips_property(dev_priv);
 
 	for (i = 0; i < VMWGFX_NUM_DISPLAY_UNITS; ++i)
 		vmw_sou_init(dev_priv, i);
@@ -794,6 +799,11 @@ int vmw_kms_sou_close_display(struct vmw_private *dev_priv)
 	return 0;
 }
 
+/*
+ * Defines the GMRFB for blits to and from @framebuffer, unless it's already
+ * defined that way. Needs dev_priv->gmrfb_mutex held until the blits using
+ * it have been committed.
+ */
 static int do_bo_define_gmrfb(struct vmw_private *dev_priv,
 				  struct vmw_framebuffer *framebuffer)
 {
@@ -801,11 +811,14 @@ static int do_bo_define_gmrfb(struct vmw_private *dev_priv,
 		container_of(framebuffer, struct vmw_framebuffer_bo,
 			     base)->buffer;
 	int depth = framebuffer->base.format->depth;
+	SVGAFifoCmdDefineGMRFB body;
 	struct {
 		uint32_t header;
 		SVGAFifoCmdDefineGMRFB body;
 	} *cmd;
 
+	lockdep_assert_held(&dev_priv->gmrfb_mutex);
+
 	/* Emulate RGBA support, contrary to svga_reg.h this is not
 	 * supported by hosts. This is only a problem if we are reading
 	 * this value later and expecting what we uploaded back.
@@ -813,6 +826,18 @@ static int do_bo_define_gmrfb(struct vmw_private *dev_priv,
 	if (depth == 32)
 		depth = 24;
 
+	memset(&body, 0, sizeof(body));
+	body.format.bitsPerPixel = framebuffer->base.format->cpp[0] * 8;
+	body.format.colorDepth = depth;
+	body.format.reserved = 0;
+	body.bytesPerLine = framebuffer->base.pitches[0];
+	/* Buffer is reserved in vram or GMR */
+	vmw_bo_get_guest_ptr(&buf->base, &body.ptr);
+
+	if (READ_ONCE(dev_priv->gmrfb_valid) &&
+	    memcmp(&dev_priv->gmrfb, &body, sizeof(body)) == 0)
+		return 0;
+
 	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd));
 	if (!cmd) {
 		DRM_ERROR("Out of fifo space for dirty framebuffer command.\n");
@@ -820,14 +845,12 @@ static int do_bo_define_gmrfb(struct vmw_private *dev_priv,
 	}
 
 	cmd->header = SVGA_CMD_DEFINE_GMRFB;
-	cmd->body.format.bitsPerPixel = framebuffer->base.format->cpp[0] * 8;
-	cmd->body.format.colorDepth = depth;
-	cmd->body.format.reserved = 0;
-	cmd->body.bytesPerLine = framebuffer->base.pitches[0];
-	/* Buffer is reserved in vram or GMR */
-	vmw_bo_get_guest_ptr(&buf->base, &cmd->body.ptr);
+	cmd->body = body;
 	vmw_fifo_commit(dev_priv, sizeof(*cmd));
 
+	dev_priv->gmrfb = body;
+	WRITE_ONCE(dev_priv->gmrfb_valid, true);
+
 	return 0;
 }
 
@@ -939,6 +962,9 @@ static void vmw_sou_surface_clip(struct vmw_kms_dirty *dirty)
  * struct vmw_fence_obj. The returned fence pointer may be NULL in which
  * case the device has already synchronized.
  * @crtc: If crtc is passed, perform surface dirty on that crtc only.
+ * @commit_ctx: Validation context of an atomic commit that has already
+ * validated @framebuffer, or NULL. If non-NULL, the commit fences the
+ * update, and @out_fence must be NULL.
  *
  * Returns 0 on success, negative error code on failure. -ERESTARTSYS if
  * interrupted.
@@ -952,7 +978,8 @@ int vmw_kms_sou_do_surface_dirty(struct vmw_private *dev_priv,
 				 s32 dest_y,
 				 unsigned num_clips, int inc,
 				 struct vmw_fence_obj **out_fence,
-				 struct drm_crtc *crtc)
+				 struct drm_crtc *crtc,
+				 struct vmw_validation_context *commit_ctx)
 {
 	struct vmw_framebuffer_surface *vfbs =
 		container_of(framebuffer, typeof(*vfbs), base);
@@ -963,13 +990,17 @@ int vmw_kms_sou_do_surface_dirty(struct vmw_private *dev_priv,
 	if (!srf)
 		srf = &vfbs->surface->res;
 
-	ret = vmw_validation_add_resource(&val_ctx, srf, 0, NULL, NULL);
-	if (ret)
-		return ret;
+	if (!commit_ctx) {
+		ret = vmw_validation_add_resource(&val_ctx, srf, 0, NULL,
+						  NULL);
+		if (ret)
+			return ret;
 
-	ret = vmw_validation_prepare(&val_ctx, &dev_priv->cmdbuf_mutex, true);
-	if (ret)
-		goto out_unref;
+		ret = vmw_validation_prepare(&val_ctx, &dev_priv->cmdbuf_mutex,
+					     true);
+		if (ret)
+			goto out_unref;
+	}
 
 	sdirty.base.fifo_commit = vmw_sou_surface_fifo_commit;
 	sdirty.base.clip = vmw_sou_surface_clip;
@@ -987,8 +1018,9 @@ int vmw_kms_sou_do_surface_dirty(struct vmw_private *dev_priv,
 	ret = vmw_kms_helper_dirty(dev_priv, framebuffer, clips, vclips,
 				   dest_x, dest_y, num_clips, inc,
 				   &sdirty.base);
-	vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx, out_fence,
-					 NULL);
+	if (!commit_ctx)
+		vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx,
+						 out_fence, NULL);
 
 	return ret;
 
@@ -1054,6 +1086,9 @@ static void vmw_sou_bo_clip(struct vmw_kms_dirty *dirty)
  * struct vmw_fence_obj. The returned fence pointer may be NULL in which
  * case the device has already synchronized.
  * @crtc: If crtc is passed, perform bo dirty on that crtc only.
+ * @commit_ctx: Validation context of an atomic commit that has already
+ * validated @framebuffer, or NULL. If non-NULL, the commit fences the
+ * update, and @out_fence must be NULL.
  *
  * Returns 0 on success, negative error code on failure. -ERESTARTSYS if
  * interrupted.
@@ -1065,7 +1100,8 @@ int vmw_kms_sou_do_bo_dirty(struct vmw_private *dev_priv,
 				unsigned num_clips, int increment,
 				bool interruptible,
 				struct vmw_fence_obj **out_fence,
-				struct drm_crtc *crtc)
+				struct drm_crtc *crtc,
+				struct vmw_validation_context *commit_ctx)
 {
 	struct vmw_buffer_object *buf =
 		container_of(framebuffer, struct vmw_framebuffer_bo,
@@ -1074,17 +1110,24 @@ int vmw_kms_sou_do_bo_dirty(struct vmw_private *dev_priv,
 	DECLARE_VAL_CONTEXT(val_ctx, NULL, 0);
 	int ret;
 
-	ret = vmw_validation_add_bo(&val_ctx, buf, false, false);
-	if (ret)
-		return ret;
+	if (!commit_ctx) {
+		ret = vmw_validation_add_bo(&val_ctx, buf, false, false);
+		if (ret)
+			return ret;
 
-	ret = vmw_validation_prepare(&val_ctx, NULL, interruptible);
-	if (ret)
-		goto out_unref;
+		ret = vmw_validation_prepare(&val_ctx, NULL, interruptible);
+		if (ret)
+			goto out_unref;
+	}
 
+	mutex_lock(&dev_priv->gmrfb_mutex);
 	ret = do_bo_define_gmrfb(dev_priv, framebuffer);
-	if (unlikely(ret != 0))
+	if (unlikely(ret != 0)) {
+		mutex_unlock(&dev_priv->gmrfb_mutex);
+		if (commit_ctx)
+			return ret;
 		goto out_revert;
+	}
 
 	dirty.crtc = crtc;
 	dirty.fifo_commit = vmw_sou_bo_fifo_commit;
@@ -1093,8 +1136,10 @@ int vmw_kms_sou_do_bo_dirty(struct vmw_private *dev_priv,
 		num_clips;
 	ret = vmw_kms_helper_dirty(dev_priv, framebuffer, clips, vclips,
 				   0, 0, num_clips, increment, &dirty);
-	vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx, out_fence,
-					 NULL);
+	mutex_unlock(&dev_priv->gmrfb_mutex);
+	if (!commit_ctx)
+		vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx,
+						 out_fence, NULL);
 
 	return ret;
 
@@ -1188,9 +1233,12 @@ int vmw_kms_sou_readback(struct vmw_private *dev_priv,
 	if (ret)
 		goto out_unref;
 
+	mutex_lock(&dev_priv->gmrfb_mutex);
 	ret = do_bo_define_gmrfb(dev_priv, vfb);
-	if (unlikely(ret != 0))
+	if (unlikely(ret != 0)) {
+		mutex_unlock(&dev_priv->gmrfb_mutex);
 		goto out_revert;
+	}
 
 	dirty.crtc = crtc;
 	dirty.fifo_commit = vmw_sou_readback_fifo_commit;
@@ -1199,6 +1247,7 @@ int vmw_kms_sou_readback(struct vmw_private *dev_priv,
 		num_clips;
 	ret = vmw_kms_helper_dirty(dev_priv, vfb, NULL, vclips,
 				   0, 0, num_clips, 1, &dirty);
+	mutex_unlock(&dev_priv->gmrfb_mutex);
 	vmw_kms_helper_validation_finish(dev_priv, file_priv, &val_ctx, NULL,
 					 user_fence_rep);
 
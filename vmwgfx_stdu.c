@@ -41,6 +41,8 @@
 
 
 
+#define VMW_STDU_SRF_CACHE_SIZE 3
+
 enum stdu_content_type {
 	SAME_AS_DISPLAY = 0,
 	SEPARATE_SURFACE,
@@ -104,6 +106,15 @@ struct vmw_stdu_surface_copy {
  *               is a separate buffer to which content_vfbs will blit to.
  * @content_type:  content_fb type
  * @defined:  true if the current display unit has been initialized
+ * @bound_sid: id of the surface bound to the screen target, or
+ *             SVGA3D_INVALID_ID if none.
+ * @srf_cache: Recently displayed surfaces, most recent first. Each entry
+ *             holds a reference and a pin, so that flipping between a few
+ *             framebuffers doesn't re-validate their surfaces every time.
+ * @srf_cache_pending: Surface to add to @srf_cache, and
+ * @srf_cache_flush: whether to flush @srf_cache, once the commands of the
+ *             current atomic commit have been fenced. Pinning can't be
+ *             done while the commit holds its validation reservations.
  */
 struct vmw_screen_target_display_unit {
 	struct vmw_display_unit base;
@@ -112,6 +123,10 @@ struct vmw_screen_target_display_unit {
 	s32 display_width, display_height;
 
 	bool defined;
+	u32 bound_sid;
+	struct vmw_surface *srf_cache[VMW_STDU_SRF_CACHE_SIZE];
+	struct vmw_surface *srf_cache_pending;
+	bool srf_cache_flush;
 
 	/* For CPU Blit */
 	unsigned int cpp;
@@ -187,6 +202,7 @@ static int vmw_stdu_define_st(struct vmw_private *dev_priv,
 	vmw_fifo_commit(dev_priv, sizeof(*cmd));
 
 	stdu->defined = true;
+	stdu->bound_sid = SVGA3D_INVALID_ID;
 	stdu->display_width  = mode->hdisplay;
 	stdu->display_height = mode->vdisplay;
 
@@ -202,7 +218,8 @@ static int vmw_stdu_define_st(struct vmw_private *dev_priv,
  * @stdu: display unit affected
  * @res: Buffer to bind to the screen target.  Set to NULL to blank screen.
  *
- * Binding a surface to a Screen Target the same as flipping
+ * Binding a surface to a Screen Target the same as flipping. Nothing is
+ * emitted if the surface is already bound.
  */
 static int vmw_stdu_bind_st(struct vmw_private *dev_priv,
 			    struct vmw_screen_target_display_unit *stdu,
@@ -225,6 +242,9 @@ static int vmw_stdu_bind_st(struct vmw_private *dev_priv,
 	memset(&image, 0, sizeof(image));
 	image.sid = res ? res->id : SVGA3D_INVALID_ID;
 
+	if (image.sid == stdu->bound_sid)
+		return 0;
+
 	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd));
 
 	if (unlikely(cmd == NULL)) {
@@ -240,9 +260,98 @@ static int vmw_stdu_bind_st(struct vmw_private *dev_priv,
 
 	vmw_fifo_commit(dev_priv, sizeof(*cmd));
 
+	stdu->bound_sid = image.sid;
+
 	return 0;
 }
 
+/**
+ * vmw_stdu_srf_cache_add - Mark a surface as the most recently displayed
+ *
+ * @stdu: display unit affected
+ * @srf: The surface being displayed.
+ *
+ * Moves @srf to the front of the cache, pinning it if it wasn't cached.
+ * The least recently displayed surface is released if the cache is full.
+ * Failing to pin is harmless, since the plane state keeps its own pin.
+ */
+static void vmw_stdu_srf_cache_add(struct vmw_screen_target_display_unit *stdu,
+				   struct vmw_surface *srf)
+{
+	struct vmw_surface *evict;
+	int i;
+
+	for (i = 0; i < VMW_STDU_SRF_CACHE_SIZE - 1; i++)
+		if (stdu->srf_cache[i] == srf)
+			break;
+
+	evict = stdu->srf_cache[i];
+	if (evict != srf) {
+		if (vmw_resource_pin(&srf->res, false))
+			return;
+
+		srf = vmw_surface_reference(srf);
+	}
+
+	memmove(&stdu->srf_cache[1], &stdu->srf_cache[0],
+		i * sizeof(stdu->srf_cache[0]));
+	stdu->srf_cache[0] = srf;
+
+	if (evict && evict != srf) {
+		vmw_resource_unpin(&evict->res);
+		vmw_surface_unreference(&evict);
+	}
+}
+
+/**
+ * vmw_stdu_srf_cache_flush - Release all cached surfaces
+ *
+ * @stdu: display unit affected
+ */
+static void vmw_stdu_srf_cache_flush(struct vmw_screen_target_display_unit *stdu)
+{
+	int i;
+
+	for (i = 0; i < VMW_STDU_SRF_CACHE_SIZE; i++) {
+		if (!stdu->srf_cache[i])
+			continue;
+
+		vmw_resource_unpin(&stdu->srf_cache[i]->res);
+		vmw_surface_unreference(&stdu->srf_cache[i]);
+	}
+}
+
+/**
+ * vmw_kms_stdu_commit_done - Update the surface caches after a commit
+ *
+ * @old_state: The atomic state being committed.
+ *
+ * Called from the commit tail once the commit's validation context has been
+ * fenced and released, to apply the surface cache changes recorded by the
+ * plane updates.
+ */
+void vmw_kms_stdu_commit_done(struct drm_atomic_state *old_state)
+{
+	struct vmw_screen_target_display_unit *stdu;
+	struct drm_crtc_state *new_crtc_state;
+	struct drm_crtc *crtc;
+	int i;
+
+	for_each_new_crtc_in_state(old_state, crtc, new_crtc_state, i) {
+		stdu = vmw_crtc_to_stdu(crtc);
+
+		if (stdu->srf_cache_flush) {
+			vmw_stdu_srf_cache_flush(stdu);
+			stdu->srf_cache_flush = false;
+		}
+
+		if (stdu->srf_cache_pending) {
+			vmw_stdu_srf_cache_add(stdu, stdu->srf_cache_pending);
+			stdu->srf_cache_pending = NULL;
+		}
+	}
+}
+
 /**
  * vmw_stdu_populate_update - populate an UPDATE_GB_SCREENTARGET command with a
  * bounding box.
@@ -351,6 +460,7 @@ static int vmw_stdu_destroy_st(struct vmw_private *dev_priv,
 		DRM_ERROR("Failed to sync with HW");
 
 	stdu->defined = false;
+	stdu->bound_sid = SVGA3D_INVALID_ID;
 	stdu->display_width  = 0;
 	stdu->display_height = 0;
 
@@ -393,6 +503,9 @@ static void vmw_stdu_crtc_mode_set_nofb(struct drm_crtc *crtc)
 		stdu->content_fb_type = SAME_AS_DISPLAY;
 	}
 
+	/* Cached surfaces likely don't match the new mode */
+	vmw_stdu_srf_cache_flush(stdu);
+
 	if (!crtc->state->enable)
 		return;
 
@@ -436,6 +549,8 @@ static void vmw_stdu_crtc_helper_commit(struct drm_crtc *crtc)
 		vmw_kms_add_active(dev_priv, &stdu->base, vfb);
 	else
 		vmw_kms_del_active(dev_priv, &stdu->base);
+
+	drm_crtc_vblank_on(crtc);
 }
 
 static void vmw_stdu_crtc_helper_disable(struct drm_crtc *crtc)
@@ -450,6 +565,8 @@ static void vmw_stdu_crtc_helper_disable(struct drm_crtc *crtc)
 		return;
 	}
 
+	drm_crtc_vblank_off(crtc);
+
 	stdu     = vmw_crtc_to_stdu(crtc);
 	dev_priv = vmw_priv(crtc->dev);
 
@@ -466,6 +583,8 @@ static void vmw_stdu_crtc_helper_disable(struct drm_crtc *crtc)
 
 		stdu->content_fb_type = SAME_AS_DISPLAY;
 	}
+
+	vmw_stdu_srf_cache_flush(stdu);
 }
 
 /**
@@ -679,36 +798,45 @@ static void vmw_stdu_bo_cpu_commit(struct vmw_kms_dirty *dirty)
 
 	if (ddirty->transfer == SVGA3D_WRITE_HOST_VRAM &&
 	    drm_rect_visible(&diff.rect)) {
-		struct vmw_private *dev_priv;
+		struct vmw_private *dev_priv = vmw_priv(stdu->base.crtc.dev);
+		struct drm_clip_rect regions[VMW_DIFF_MAX_RECTS];
 		struct vmw_stdu_update *cmd;
-		struct drm_clip_rect region;
+		u64 transferred = 0;
+		unsigned int i;
 		int ret;
 
 		/* We are updating the actual surface, not a proxy */
-		region.x1 = diff.rect.x1;
-		region.x2 = diff.rect.x2;
-		region.y1 = diff.rect.y1;
-		region.y2 = diff.rect.y2;
+		for (i = 0; i < diff.num_rects; ++i) {
+			regions[i].x1 = diff.rects[i].x1;
+			regions[i].x2 = diff.rects[i].x2;
+			regions[i].y1 = diff.rects[i].y1;
+			regions[i].y2 = diff.rects[i].y2;
+			transferred += (u64) drm_rect_width(&diff.rects[i]) *
+				drm_rect_height(&diff.rects[i]);
+		}
+
 		ret = vmw_kms_update_proxy(
 			(struct vmw_resource *) &stdu->display_srf->res,
-			(const struct drm_clip_rect *) &region, 1, 1);
+			regions, diff.num_rects, 1);
 		if (ret)
 			goto out_cleanup;
 
-
-		dev_priv = vmw_priv(stdu->base.crtc.dev);
-		cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd));
+		cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd) * diff.num_rects);
 
 		if (!cmd) {
 			DRM_ERROR("Cannot reserve FIFO space to update STDU");
 			goto out_cleanup;
 		}
 
-		vmw_stdu_populate_update(cmd, stdu->base.unit,
-					 region.x1, region.x2,
-					 region.y1, region.y2);
+		for (i = 0; i < diff.num_rects; ++i)
+			vmw_stdu_populate_update(&cmd[i], stdu->base.unit,
+						 regions[i].x1, regions[i].x2,
+						 regions[i].y1, regions[i].y2);
+
+		vmw_fifo_commit(dev_priv, sizeof(*cmd) * diff.num_rects);
 
-		vmw_fifo_commit(dev_priv, sizeof(*cmd));
+		atomic64_add(diff.modified, &dev_priv->cpu_blit_modified);
+		atomic64_add(transferred, &dev_priv->cpu_blit_transferred);
 	}
 
 out_cleanup:
@@ -733,6 +861,9 @@ out_cleanup:
  * from the screen target system.
  * @interruptible: Whether to perform waits interruptible if possible.
  * @crtc: If crtc is passed, perform stdu dma on that crtc only.
+ * @commit_ctx: Validation context of an atomic commit that has already
+ * validated @vfb, or NULL. If non-NULL, the commit fences the transfer,
+ * and @file_priv must be NULL.
  *
  * If DMA-ing till the screen target system, the function will also notify
  * the screen target system that a bounding box of the cliprects has been
@@ -750,7 +881,8 @@ int vmw_kms_stdu_dma(struct vmw_private *dev_priv,
 		     int increment,
 		     bool to_surface,
 		     bool interruptible,
-		     struct drm_crtc *crtc)
+		     struct drm_crtc *crtc,
+		     struct vmw_validation_context *commit_ctx)
 {
 	struct vmw_buffer_object *buf =
 		container_of(vfb, struct vmw_framebuffer_bo, base)->buffer;
@@ -764,13 +896,15 @@ int vmw_kms_stdu_dma(struct vmw_private *dev_priv,
 	 * we'll be using a CPU blit, and the framebuffer should be moved out
 	 * of VRAM.
 	 */
-	ret = vmw_validation_add_bo(&val_ctx, buf, false, cpu_blit);
-	if (ret)
-		return ret;
+	if (!commit_ctx) {
+		ret = vmw_validation_add_bo(&val_ctx, buf, false, cpu_blit);
+		if (ret)
+			return ret;
 
-	ret = vmw_validation_prepare(&val_ctx, NULL, interruptible);
-	if (ret)
-		goto out_unref;
+		ret = vmw_validation_prepare(&val_ctx, NULL, interruptible);
+		if (ret)
+			goto out_unref;
+	}
 
 	ddirty.transfer = (to_surface) ? SVGA3D_WRITE_HOST_VRAM :
 		SVGA3D_READ_HOST_VRAM;
@@ -799,8 +933,9 @@ int vmw_kms_stdu_dma(struct vmw_private *dev_priv,
 	ret = vmw_kms_helper_dirty(dev_priv, vfb, clips, vclips,
 				   0, 0, num_clips, increment, &ddirty.base);
 
-	vmw_kms_helper_validation_finish(dev_priv, file_priv, &val_ctx, NULL,
-					 user_fence_rep);
+	if (!commit_ctx)
+		vmw_kms_helper_validation_finish(dev_priv, file_priv, &val_ctx,
+						 NULL, user_fence_rep);
 	return ret;
 
 out_unref:
@@ -912,6 +1047,9 @@ static void vmw_kms_stdu_surface_fifo_commit(struct vmw_kms_dirty *dirty)
  * struct vmw_fence_obj. The returned fence pointer may be NULL in which
  * case the device has already synchronized.
  * @crtc: If crtc is passed, perform surface dirty on that crtc only.
+ * @commit_ctx: Validation context of an atomic commit that has already
+ * validated @framebuffer, or NULL. If non-NULL, the commit fences the
+ * update, and @out_fence must be NULL.
  *
  * Returns 0 on success, negative error code on failure. -ERESTARTSYS if
  * interrupted.
@@ -925,7 +1063,8 @@ int vmw_kms_stdu_surface_dirty(struct vmw_private *dev_priv,
 			       s32 dest_y,
 			       unsigned num_clips, int inc,
 			       struct vmw_fence_obj **out_fence,
-			       struct drm_crtc *crtc)
+			       struct drm_crtc *crtc,
+			       struct vmw_validation_context *commit_ctx)
 {
 	struct vmw_framebuffer_surface *vfbs =
 		container_of(framebuffer, typeof(*vfbs), base);
@@ -936,13 +1075,17 @@ int vmw_kms_stdu_surface_dirty(struct vmw_private *dev_priv,
 	if (!srf)
 		srf = &vfbs->surface->res;
 
-	ret = vmw_validation_add_resource(&val_ctx, srf, 0, NULL, NULL);
-	if (ret)
-		return ret;
+	if (!commit_ctx) {
+		ret = vmw_validation_add_resource(&val_ctx, srf, 0, NULL,
+						  NULL);
+		if (ret)
+			return ret;
 
-	ret = vmw_validation_prepare(&val_ctx, &dev_priv->cmdbuf_mutex, true);
-	if (ret)
-		goto out_unref;
+		ret = vmw_validation_prepare(&val_ctx, &dev_priv->cmdbuf_mutex,
+					     true);
+		if (ret)
+			goto out_unref;
+	}
 
 	if (vfbs->is_bo_proxy) {
 		ret = vmw_kms_update_proxy(srf, clips, num_clips, inc);
@@ -964,8 +1107,9 @@ int vmw_kms_stdu_surface_dirty(struct vmw_private *dev_priv,
 				   dest_x, dest_y, num_clips, inc,
 				   &sdirty.base);
 out_finish:
-	vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx, out_fence,
-					 NULL);
+	if (!commit_ctx)
+		vmw_kms_helper_validation_finish(dev_priv, NULL, &val_ctx,
+						 out_fence, NULL);
 
 	return ret;
 
@@ -1275,7 +1419,6 @@ vmw_stdu_primary_plane_atomic_update(struct drm_plane *plane,
 	struct vmw_plane_state *vps = vmw_plane_state_to_vps(plane->state);
 	struct drm_crtc *crtc = plane->state->crtc;
 	struct vmw_screen_target_display_unit *stdu;
-	struct drm_pending_vblank_event *event;
 	struct vmw_private *dev_priv;
 	int ret;
 
@@ -1286,34 +1429,52 @@ vmw_stdu_primary_plane_atomic_update(struct drm_plane *plane,
 	if (crtc && plane->state->fb) {
 		struct vmw_framebuffer *vfb =
 			vmw_framebuffer_to_vfb(plane->state->fb);
-		struct drm_vmw_rect vclips;
+		struct drm_vmw_rect vclips[VMW_DAMAGE_MAX_CLIPS];
+		struct drm_vmw_rect full;
+		unsigned int num_clips;
+		bool new_display;
+
 		stdu = vmw_crtc_to_stdu(crtc);
 		dev_priv = vmw_priv(crtc->dev);
 
+		/*
+		 * A newly bound display surface doesn't hold the previously
+		 * displayed contents, so it needs a full update.
+		 */
+		new_display = (stdu->display_srf != vps->surf);
 		stdu->display_srf = vps->surf;
 		stdu->content_fb_type = vps->content_fb_type;
 		stdu->cpp = vps->cpp;
 
-		vclips.x = crtc->x;
-		vclips.y = crtc->y;
-		vclips.w = crtc->mode.hdisplay;
-		vclips.h = crtc->mode.vdisplay;
+		full.x = crtc->x;
+		full.y = crtc->y;
+		full.w = crtc->mode.hdisplay;
+		full.h = crtc->mode.vdisplay;
+		num_clips = vmw_du_plane_damage(plane, old_state, &full,
+						vclips, new_display);
 
 		ret = vmw_stdu_bind_st(dev_priv, stdu, &stdu->display_srf->res);
 		if (ret)
 			DRM_ERROR("Failed to bind surface to STDU.\n");
+		else
+			stdu->srf_cache_pending = vps->surf;
 
-		if (vfb->bo)
+		if (!num_clips)
+			ret = 0;
+		else if (vfb->bo)
 			ret = vmw_kms_stdu_dma(dev_priv, NULL, vfb, NULL, NULL,
-					       &vclips, 1, 1, true, false,
-					       crtc);
+					       vclips, num_clips, 1, true,
+					       false, crtc, vps->val_ctx);
 		else
 			ret = vmw_kms_stdu_surface_dirty(dev_priv, vfb, NULL,
-							 &vclips, NULL, 0, 0,
-							 1, 1, NULL, crtc);
+							 vclips, NULL, 0, 0,
+							 num_clips, 1, NULL,
+							 crtc, vps->val_ctx);
 		if (ret)
 			DRM_ERROR("Failed to update STDU.\n");
 
+		stdu->base.damage_full = (ret != 0);
+
 		crtc->primary->fb = plane->state->fb;
 	} else {
 		crtc = old_state->crtc;
@@ -1337,40 +1498,14 @@ vmw_stdu_primary_plane_atomic_update(struct drm_plane *plane,
 		if (ret)
 			DRM_ERROR("Failed to update STDU.\n");
 
+		stdu->srf_cache_flush = true;
 		return;
 	}
 
-	event = crtc->state->event;
 	/*
-	 * In case of failure and other cases, vblank event will be sent in
-	 * vmw_du_crtc_atomic_flush.
+	 * The vblank event is queued and the commands are flushed in
+	 * vmw_kms_commit_events(), together with other display units.
 	 */
-	if (event && (ret == 0)) {
-		struct vmw_fence_obj *fence = NULL;
-		struct drm_file *file_priv = event->base.file_priv;
-
-		vmw_execbuf_fence_commands(NULL, dev_priv, &fence, NULL);
-
-		/*
-		 * If fence is NULL, then already sync.
-		 */
-		if (fence) {
-			ret = vmw_event_fence_action_queue(file_priv,
-							   fence,
-							   &event->base,
-							   &event->event.tv_sec,
-							   &event->event.tv_usec,
-							   true);
-			if (ret)
-				DRM_ERROR("Failed to queue event on fence.\n");
-			else
-				crtc->state->event = NULL;
-
-			vmw_fence_obj_unreference(&fence);
-		}
-	} else {
-		(void) vmw_fifo_flush(dev_priv, false);
-	}
 }
 
 
@@ -1381,6 +1516,8 @@ static const struct drm_plane_funcs vmw_stdu_plane_funcs = {
 	.reset = vmw_du_plane_reset,
 	.atomic_duplicate_state = vmw_du_plane_duplicate_state,
 	.atomic_destroy_state = vmw_du_plane_destroy_state,
+	.atomic_set_property = vmw_du_plane_atomic_set_property,
+	.atomic_get_property = vmw_du_plane_atomic_get_property,
 };
 
 static const struct drm_plane_funcs vmw_stdu_cursor_funcs = {
@@ -1449,6 +1586,7 @@ static int vmw_stdu_init(struct vmw_private *dev_priv, unsigned unit)
 		return -ENOMEM;
 
 	stdu->base.unit = unit;
+	vmw_du_vblank_init(&stdu->base);
 	crtc = &stdu->base.crtc;
 	encoder = &stdu->base.encoder;
 	connector = &stdu->base.connector;
@@ -1550,6 +1688,9 @@ static int vmw_stdu_init(struct vmw_private *dev_priv, unsigned unit)
 			(&connector->base,
 			 dev_priv->implicit_placement_property,
 			 stdu->base.is_implicit);
+	if (dev_priv->damage_clips_property)
+		drm_object_attach_property(&primary->base,
+					   dev_priv->damage_clips_property, 0);
 	return 0;
 
 err_free_unregister:
@@ -1574,6 +1715,7 @@ err_free:
  */
 static void vmw_stdu_destroy(struct vmw_screen_target_display_unit *stdu)
 {
+	vmw_stdu_srf_cache_flush(stdu);
 	vmw_du_cleanup(&stdu->base);
 	kfree(stdu);
 }
@@ -1619,6 +1761,7 @@ int vmw_kms_stdu_init_display(struct vmw_private *dev_priv)
 	dev_priv->active_display_unit = vmw_du_screen_target;
 
 	vmw_kms_create_implicit_placement_property(dev_priv, false);
+	vmw_kms_create_damage_clips_property(dev_priv);
 
 	for (i = 0; i < VMWGFX_NUM_DISPLAY_UNITS; ++i) {
 		ret = vmw_stdu_init(dev_priv, i);
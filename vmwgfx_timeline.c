@@ -0,0 +1,675 @@
+// SPDX-License-Identifier: GPL-2.0 OR MIT
+/**************************************************************************
+ *
+ * Copyright © 2018 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include "vmwgfx_drv.h"
+
+/*
+ * A timeline is a user-space visible sync object carrying a 64-bit,
+ * monotonically increasing point. Each submitted point is backed by a
+ * dma_fence, or by nothing if it was signaled from the CPU. A point is
+ * considered signaled when its own fence and the fences of all earlier
+ * points have signaled, so a single value, @signaled_point, describes the
+ * state of all points that are no longer on the @pending list.
+ */
+
+/**
+ * struct vmw_timeline_point - A reserved or submitted, not yet retired
+ * timeline point
+ *
+ * @head: List head for the timeline's @pending list.
+ * @point: The point value.
+ * @fence: Fence signaling the point or NULL if signaled from the CPU.
+ * Only valid if @submitted is true.
+ * @submitted: Whether the point has been committed.
+ */
+struct vmw_timeline_point {
+	struct list_head head;
+	u64 point;
+	struct dma_fence *fence;
+	bool submitted;
+};
+
+/**
+ * struct vmw_timeline - Timeline sync object
+ *
+ * @base: The TTM base object handling user-space handles.
+ * @dev_priv: Pointer to the device private structure.
+ * @lock: Protects @pending, @signaled_point, @submitted_point and
+ * @reserved_point.
+ * @pending: Reserved or submitted points not yet known to have signaled, in
+ * ascending point order.
+ * @signaled_point: All points up to and including this one have signaled.
+ * @submitted_point: All points up to and including this one have been
+ * submitted.
+ * @reserved_point: The highest point reserved for submission.
+ * @submit_queue: Wait queue for waiters on not yet submitted points.
+ * @submit_cbs: Callbacks waiting for not yet submitted points. Protected
+ * by @lock.
+ */
+struct vmw_timeline {
+	struct ttm_base_object base;
+	struct vmw_private *dev_priv;
+	spinlock_t lock;
+	struct list_head pending;
+	u64 signaled_point;
+	u64 submitted_point;
+	u64 reserved_point;
+	wait_queue_head_t submit_queue;
+	struct list_head submit_cbs;
+};
+
+static size_t vmw_timeline_acc_size;
+
+/**
+ * vmw_timeline_retire_locked - Move signaled points off the pending list
+ *
+ * @tl: The timeline.
+ * @list: List to move retired points to.
+ *
+ * Must be called with @tl::lock held. The retired points should be freed
+ * using vmw_timeline_free_points() after the lock is released, since
+ * putting the last fence reference may take other locks.
+ */
+static void vmw_timeline_retire_locked(struct vmw_timeline *tl,
+				       struct list_head *list)
+{
+	struct vmw_timeline_point *pt, *next;
+
+	list_for_each_entry_safe(pt, next, &tl->pending, head) {
+		if (!pt->submitted ||
+		    (pt->fence && !dma_fence_is_signaled(pt->fence)))
+			break;
+
+		tl->signaled_point = pt->point;
+		list_move_tail(&pt->head, list);
+	}
+}
+
+static void vmw_timeline_free_points(struct list_head *list)
+{
+	struct vmw_timeline_point *pt, *next;
+
+	list_for_each_entry_safe(pt, next, list, head) {
+		list_del(&pt->head);
+		dma_fence_put(pt->fence);
+		kfree(pt);
+	}
+}
+
+/**
+ * vmw_timeline_update - Retire signaled points of a timeline
+ *
+ * @tl: The timeline.
+ */
+static void vmw_timeline_update(struct vmw_timeline *tl)
+{
+	LIST_HEAD(retired);
+
+	spin_lock(&tl->lock);
+	vmw_timeline_retire_locked(tl, &retired);
+	spin_unlock(&tl->lock);
+
+	vmw_timeline_free_points(&retired);
+}
+
+static void vmw_timeline_base_release(struct ttm_base_object **p_base)
+{
+	struct vmw_timeline *tl =
+		container_of(*p_base, struct vmw_timeline, base);
+	struct vmw_private *dev_priv = tl->dev_priv;
+
+	*p_base = NULL;
+	vmw_timeline_free_points(&tl->pending);
+	ttm_base_object_kfree(tl, base);
+	ttm_mem_global_free(vmw_mem_glob(dev_priv), vmw_timeline_acc_size);
+}
+
+/**
+ * vmw_timeline_lookup - Look up a user-space timeline
+ *
+ * @tfile: A struct ttm_object_file identifying the caller.
+ * @handle: A handle identifying the timeline.
+ *
+ * Returns a referenced pointer to the timeline on success, an error pointer
+ * on failure. The reference should be dropped using
+ * vmw_timeline_unreference().
+ */
+struct vmw_timeline *vmw_timeline_lookup(struct ttm_object_file *tfile,
+					 u32 handle)
+{
+	struct ttm_base_object *base = ttm_base_object_lookup(tfile, handle);
+
+	if (!base || base->refcount_release != vmw_timeline_base_release) {
+		pr_err("Invalid timeline handle 0x%08lx.\n",
+		       (unsigned long)handle);
+		if (base)
+			ttm_base_object_unref(&base);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return container_of(base, struct vmw_timeline, base);
+}
+
+/**
+ * vmw_timeline_unreference - Drop a timeline reference
+ *
+ * @p_tl: Pointer to a pointer to the timeline. Cleared on return.
+ */
+void vmw_timeline_unreference(struct vmw_timeline **p_tl)
+{
+	struct ttm_base_object *base = &(*p_tl)->base;
+
+	*p_tl = NULL;
+	ttm_base_object_unref(&base);
+}
+
+/**
+ * vmw_timeline_advance_locked - Update the submitted point of a timeline
+ *
+ * @tl: The timeline.
+ * @list: List to move retired points to.
+ *
+ * Must be called with @tl::lock held after a reserved point was committed
+ * or cancelled. Advances @tl::submitted_point past all leading submitted
+ * points, retires signaled points and calls the submit callbacks of newly
+ * submitted points. Returns true if @tl::submitted_point advanced.
+ */
+static bool vmw_timeline_advance_locked(struct vmw_timeline *tl,
+					struct list_head *list)
+{
+	struct vmw_timeline_point *pt;
+	struct vmw_timeline_cb *cb, *next;
+	u64 old_point = tl->submitted_point;
+
+	list_for_each_entry(pt, &tl->pending, head) {
+		if (!pt->submitted)
+			break;
+
+		tl->submitted_point = pt->point;
+	}
+
+	vmw_timeline_retire_locked(tl, list);
+	if (tl->submitted_point == old_point)
+		return false;
+
+	list_for_each_entry_safe(cb, next, &tl->submit_cbs, head) {
+		if (cb->point <= tl->submitted_point) {
+			list_del_init(&cb->head);
+			cb->func(cb);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * vmw_timeline_reserve - Reserve a new timeline point for submission
+ *
+ * @tl: The timeline.
+ * @point: The new point. Must be larger than any previously reserved point.
+ *
+ * Reserving the point before the work signaling it is submitted makes sure
+ * the submission can't fail afterwards. The returned point must be passed
+ * to either vmw_timeline_commit() or vmw_timeline_cancel(). Until then,
+ * it and all later points are not considered submitted.
+ *
+ * Returns a pointer to the reserved point on success, ERR_PTR(-EINVAL) if
+ * @point is not larger than the current highest reserved point,
+ * ERR_PTR(-ENOMEM) on allocation failure.
+ */
+struct vmw_timeline_point *vmw_timeline_reserve(struct vmw_timeline *tl,
+						u64 point)
+{
+	struct vmw_timeline_point *pt;
+
+	pt = kmalloc(sizeof(*pt), GFP_KERNEL);
+	if (!pt)
+		return ERR_PTR(-ENOMEM);
+
+	pt->point = point;
+	pt->fence = NULL;
+	pt->submitted = false;
+
+	spin_lock(&tl->lock);
+	if (point <= tl->reserved_point) {
+		spin_unlock(&tl->lock);
+		kfree(pt);
+		return ERR_PTR(-EINVAL);
+	}
+
+	tl->reserved_point = point;
+	list_add_tail(&pt->head, &tl->pending);
+	spin_unlock(&tl->lock);
+
+	return pt;
+}
+
+/**
+ * vmw_timeline_commit - Submit a reserved timeline point
+ *
+ * @tl: The timeline.
+ * @pt: The point returned from vmw_timeline_reserve(). Owned by the
+ * timeline on return.
+ * @fence: The fence signaling the point, or NULL to signal the point from
+ * the CPU.
+ */
+void vmw_timeline_commit(struct vmw_timeline *tl,
+			 struct vmw_timeline_point *pt,
+			 struct dma_fence *fence)
+{
+	LIST_HEAD(retired);
+	bool advanced;
+
+	spin_lock(&tl->lock);
+	pt->fence = fence ? dma_fence_get(fence) : NULL;
+	pt->submitted = true;
+	advanced = vmw_timeline_advance_locked(tl, &retired);
+	spin_unlock(&tl->lock);
+
+	vmw_timeline_free_points(&retired);
+	if (advanced)
+		wake_up_all(&tl->submit_queue);
+}
+
+/**
+ * vmw_timeline_cancel - Release a reserved timeline point unsubmitted
+ *
+ * @tl: The timeline.
+ * @pt: The point returned from vmw_timeline_reserve(). Freed on return.
+ *
+ * If no later point has been reserved, the point may be reserved again.
+ */
+void vmw_timeline_cancel(struct vmw_timeline *tl,
+			 struct vmw_timeline_point *pt)
+{
+	LIST_HEAD(retired);
+	bool advanced;
+
+	spin_lock(&tl->lock);
+	list_del(&pt->head);
+	if (pt->point == tl->reserved_point) {
+		tl->reserved_point = tl->submitted_point;
+		if (!list_empty(&tl->pending))
+			tl->reserved_point =
+				max(tl->reserved_point,
+				    list_entry(tl->pending.prev,
+					       struct vmw_timeline_point,
+					       head)->point);
+	}
+	advanced = vmw_timeline_advance_locked(tl, &retired);
+	spin_unlock(&tl->lock);
+
+	kfree(pt);
+	vmw_timeline_free_points(&retired);
+	if (advanced)
+		wake_up_all(&tl->submit_queue);
+}
+
+/**
+ * vmw_timeline_attach - Submit a new timeline point
+ *
+ * @tl: The timeline.
+ * @point: The new point. Must be larger than any previously reserved point.
+ * @fence: The fence signaling the point, or NULL to signal the point from
+ * the CPU.
+ *
+ * Returns 0 on success, -EINVAL if @point is not larger than the current
+ * highest reserved point, -ENOMEM on allocation failure.
+ */
+int vmw_timeline_attach(struct vmw_timeline *tl, u64 point,
+			struct dma_fence *fence)
+{
+	struct vmw_timeline_point *pt = vmw_timeline_reserve(tl, point);
+
+	if (IS_ERR(pt))
+		return PTR_ERR(pt);
+
+	vmw_timeline_commit(tl, pt, fence);
+
+	return 0;
+}
+
+/**
+ * vmw_timeline_add_submit_cb - Add a callback for submission of a point
+ *
+ * @tl: The timeline.
+ * @point: The point.
+ * @cb: The callback to add.
+ * @func: The function to call when @point has been submitted. The function
+ * is called with the timeline lock held, and must not sleep.
+ *
+ * Returns 0 if the callback was added, -ENOENT if @point has already been
+ * submitted, in which case the callback is not added.
+ */
+int vmw_timeline_add_submit_cb(struct vmw_timeline *tl, u64 point,
+			       struct vmw_timeline_cb *cb,
+			       void (*func)(struct vmw_timeline_cb *cb))
+{
+	int ret = 0;
+
+	spin_lock(&tl->lock);
+	if (point <= tl->submitted_point) {
+		INIT_LIST_HEAD(&cb->head);
+		ret = -ENOENT;
+	} else {
+		cb->point = point;
+		cb->func = func;
+		list_add_tail(&cb->head, &tl->submit_cbs);
+	}
+	spin_unlock(&tl->lock);
+
+	return ret;
+}
+
+/**
+ * vmw_timeline_remove_submit_cb - Remove a submit callback
+ *
+ * @tl: The timeline.
+ * @cb: The callback to remove.
+ *
+ * Returns true if the callback was removed before being called, false
+ * otherwise. When this function returns, the callback function is
+ * guaranteed not to be running.
+ */
+bool vmw_timeline_remove_submit_cb(struct vmw_timeline *tl,
+				   struct vmw_timeline_cb *cb)
+{
+	bool removed;
+
+	spin_lock(&tl->lock);
+	removed = !list_empty(&cb->head);
+	if (removed)
+		list_del_init(&cb->head);
+	spin_unlock(&tl->lock);
+
+	return removed;
+}
+
+static bool vmw_timeline_submitted(struct vmw_timeline *tl, u64 point)
+{
+	bool submitted;
+
+	spin_lock(&tl->lock);
+	submitted = (point <= tl->submitted_point);
+	spin_unlock(&tl->lock);
+
+	return submitted;
+}
+
+/**
+ * vmw_timeline_next_fence - Get the oldest fence blocking a point
+ *
+ * @tl: The timeline.
+ * @point: The point.
+ *
+ * Returns NULL if @point has signaled, ERR_PTR(-ENOENT) if @point has not
+ * been submitted yet, and otherwise a referenced pointer to the fence of the
+ * oldest pending point. Callers wanting to wait for @point should wait for
+ * the returned fence and then call this function again.
+ */
+struct dma_fence *vmw_timeline_next_fence(struct vmw_timeline *tl, u64 point)
+{
+	struct vmw_timeline_point *pt;
+	struct dma_fence *fence;
+	LIST_HEAD(retired);
+
+	spin_lock(&tl->lock);
+	vmw_timeline_retire_locked(tl, &retired);
+	if (point <= tl->signaled_point) {
+		fence = NULL;
+	} else if (point > tl->submitted_point) {
+		fence = ERR_PTR(-ENOENT);
+	} else {
+		pt = list_first_entry(&tl->pending, typeof(*pt), head);
+		fence = dma_fence_get(pt->fence);
+	}
+	spin_unlock(&tl->lock);
+	vmw_timeline_free_points(&retired);
+
+	return fence;
+}
+
+/**
+ * vmw_timeline_wait - Wait for a timeline point to signal
+ *
+ * @tl: The timeline.
+ * @point: The point to wait for.
+ * @for_submit: Wait for @point to be submitted if it hasn't been already.
+ * Otherwise an unsubmitted point fails with -EINVAL.
+ * @interruptible: Whether to perform interruptible waits.
+ * @timeout: Timeout in jiffies.
+ *
+ * Returns the remaining timeout if @point signaled, 0 on timeout or
+ * a negative error code on failure.
+ */
+long vmw_timeline_wait(struct vmw_timeline *tl, u64 point, bool for_submit,
+		       bool interruptible, long timeout)
+{
+	struct dma_fence *fence;
+	long ret;
+
+	if (for_submit) {
+		if (interruptible)
+			ret = wait_event_interruptible_timeout
+				(tl->submit_queue,
+				 vmw_timeline_submitted(tl, point), timeout);
+		else
+			ret = wait_event_timeout
+				(tl->submit_queue,
+				 vmw_timeline_submitted(tl, point), timeout);
+		if (ret <= 0)
+			return ret;
+
+		timeout = ret;
+	}
+
+	for (;;) {
+		fence = vmw_timeline_next_fence(tl, point);
+		if (!fence)
+			return timeout;
+		if (IS_ERR(fence))
+			return -EINVAL;
+
+		ret = dma_fence_wait_timeout(fence, interruptible, timeout);
+		dma_fence_put(fence);
+		if (ret <= 0)
+			return ret;
+
+		timeout = ret;
+	}
+}
+
+int vmw_timeline_create_ioctl(struct drm_device *dev, void *data,
+			      struct drm_file *file_priv)
+{
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct drm_vmw_timeline_create_arg *arg =
+		(struct drm_vmw_timeline_create_arg *)data;
+	struct ttm_object_file *tfile = vmw_fpriv(file_priv)->tfile;
+	struct vmw_timeline *tl;
+	int ret;
+
+	if (unlikely(vmw_timeline_acc_size == 0))
+		vmw_timeline_acc_size =
+			ttm_round_pot(sizeof(struct vmw_timeline)) +
+			TTM_OBJ_EXTRA_SIZE;
+
+	ret = ttm_mem_global_alloc(vmw_mem_glob(dev_priv),
+				   vmw_timeline_acc_size, false, true);
+	if (unlikely(ret != 0))
+		return ret;
+
+	tl = kzalloc(sizeof(*tl), GFP_KERNEL);
+	if (unlikely(!tl)) {
+		ret = -ENOMEM;
+		goto out_no_object;
+	}
+
+	tl->dev_priv = dev_priv;
+	spin_lock_init(&tl->lock);
+	INIT_LIST_HEAD(&tl->pending);
+	init_waitqueue_head(&tl->submit_queue);
+	INIT_LIST_HEAD(&tl->submit_cbs);
+	tl->signaled_point = arg->initial_point;
+	tl->submitted_point = arg->initial_point;
+	tl->reserved_point = arg->initial_point;
+
+	ret = ttm_base_object_init(tfile, &tl->base, false, VMW_RES_TIMELINE,
+				   &vmw_timeline_base_release, NULL);
+	if (unlikely(ret != 0)) {
+		kfree(tl);
+		goto out_no_object;
+	}
+
+	arg->handle = tl->base.handle;
+
+	return 0;
+
+out_no_object:
+	ttm_mem_global_free(vmw_mem_glob(dev_priv), vmw_timeline_acc_size);
+	return ret;
+}
+
+int vmw_timeline_unref_ioctl(struct drm_device *dev, void *data,
+			     struct drm_file *file_priv)
+{
+	struct drm_vmw_handle_close_arg *arg =
+		(struct drm_vmw_handle_close_arg *)data;
+
+	return ttm_ref_object_base_unref(vmw_fpriv(file_priv)->tfile,
+					 arg->handle, TTM_REF_USAGE);
+}
+
+int vmw_timeline_query_ioctl(struct drm_device *dev, void *data,
+			     struct drm_file *file_priv)
+{
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct drm_vmw_timeline_query_arg *arg =
+		(struct drm_vmw_timeline_query_arg *)data;
+	struct ttm_object_file *tfile = vmw_fpriv(file_priv)->tfile;
+	struct vmw_timeline *tl;
+
+	tl = vmw_timeline_lookup(tfile, arg->handle);
+	if (IS_ERR(tl))
+		return PTR_ERR(tl);
+
+	/* Make sure device fences reflect the latest passed seqno. */
+	vmw_fences_update(dev_priv->fman);
+	vmw_timeline_update(tl);
+
+	spin_lock(&tl->lock);
+	arg->signaled_point = tl->signaled_point;
+	arg->submitted_point = tl->submitted_point;
+	spin_unlock(&tl->lock);
+
+	vmw_timeline_unreference(&tl);
+
+	return 0;
+}
+
+int vmw_timeline_wait_ioctl(struct drm_device *dev, void *data,
+			    struct drm_file *file_priv)
+{
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct drm_vmw_timeline_wait_arg *arg =
+		(struct drm_vmw_timeline_wait_arg *)data;
+	struct ttm_object_file *tfile = vmw_fpriv(file_priv)->tfile;
+	bool for_submit = !!(arg->flags & DRM_VMW_TIMELINE_WAIT_FLAG_FOR_SUBMIT);
+	uint64_t wait_timeout = ((uint64_t)arg->timeout_us * HZ);
+	struct vmw_timeline *tl;
+	unsigned long timeout;
+	long ret;
+
+	/* Divide by 1000000, see vmw_fence_obj_wait_ioctl(). */
+	wait_timeout = (wait_timeout >> 20) + (wait_timeout >> 24) -
+	  (wait_timeout >> 26);
+
+	if (!arg->cookie_valid) {
+		arg->cookie_valid = 1;
+		arg->kernel_cookie = jiffies + wait_timeout;
+	}
+
+	tl = vmw_timeline_lookup(tfile, arg->handle);
+	if (IS_ERR(tl))
+		return PTR_ERR(tl);
+
+	timeout = jiffies;
+	if (time_after_eq(timeout, (unsigned long)arg->kernel_cookie))
+		timeout = 0;
+	else
+		timeout = (unsigned long)arg->kernel_cookie - timeout;
+
+	if (arg->flags & DRM_VMW_TIMELINE_WAIT_FLAG_AVAILABLE) {
+		if (vmw_timeline_submitted(tl, arg->point))
+			ret = 1;
+		else if (!for_submit)
+			ret = -EINVAL;
+		else
+			ret = wait_event_interruptible_timeout
+				(tl->submit_queue,
+				 vmw_timeline_submitted(tl, arg->point),
+				 timeout);
+	} else if (timeout == 0) {
+		struct dma_fence *fence;
+
+		vmw_fences_update(dev_priv->fman);
+		fence = vmw_timeline_next_fence(tl, arg->point);
+		ret = IS_ERR(fence) ? -EINVAL : !fence;
+		if (!IS_ERR_OR_NULL(fence))
+			dma_fence_put(fence);
+	} else {
+		ret = vmw_timeline_wait(tl, arg->point, for_submit, true,
+					timeout);
+	}
+
+	vmw_timeline_unreference(&tl);
+
+	if (ret == 0)
+		return -EBUSY;
+
+	return (ret < 0) ? ret : 0;
+}
+
+int vmw_timeline_signal_ioctl(struct drm_device *dev, void *data,
+			      struct drm_file *file_priv)
+{
+	struct drm_vmw_timeline_signal_arg *arg =
+		(struct drm_vmw_timeline_signal_arg *)data;
+	struct ttm_object_file *tfile = vmw_fpriv(file_priv)->tfile;
+	struct vmw_timeline *tl;
+	int ret;
+
+	tl = vmw_timeline_lookup(tfile, arg->handle);
+	if (IS_ERR(tl))
+		return PTR_ERR(tl);
+
+	ret = vmw_timeline_attach(tl, arg->point, NULL);
+	vmw_timeline_unreference(&tl);
+
+	return ret;
+}
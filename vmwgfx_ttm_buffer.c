@@ -246,10 +246,24 @@ struct vmw_ttm_tt {
 	struct vmw_sg_table vsgt;
 	uint64_t sg_alloc_size;
 	bool mapped;
+	struct list_head dma_cache_head;
 };
 
+/*
+ * In vmw_dma_map_bind mode, the DMA mappings of unbound ttms are kept on
+ * a bounded LRU list rather than being torn down at unbind time, so that
+ * buffers moving back and forth between system and GMR / MOB placement
+ * don't pay for IOMMU mapping on every bind. The device can't access the
+ * pages of an unbound ttm, so the mappings may be torn down at any time.
+ * The cache is bounded by the total number of pages mapped, since that is
+ * what consumes IOMMU address space.
+ */
+#define VMW_DMA_CACHE_MAX_PAGES ((64UL << 20) >> PAGE_SHIFT)
+
 const size_t vmw_tt_size = sizeof(struct vmw_ttm_tt);
 
+static bool vmw_ttm_dma_cache_flush(struct vmw_private *dev_priv);
+
 /**
  * Helper functions to advance a struct vmw_piter iterator.
  *
@@ -372,6 +386,7 @@ static void vmw_ttm_unmap_from_dma(struct vmw_ttm_tt *vmw_tt)
 	dma_unmap_sg(dev, vmw_tt->sgt.sgl, vmw_tt->sgt.nents,
 		DMA_BIDIRECTIONAL);
 	vmw_tt->sgt.nents = vmw_tt->sgt.orig_nents;
+	atomic64_inc(&vmw_tt->dev_priv->dma_unmaps);
 }
 
 /**
@@ -394,14 +409,41 @@ static int vmw_ttm_map_for_dma(struct vmw_ttm_tt *vmw_tt)
 
 	ret = dma_map_sg(dev, vmw_tt->sgt.sgl, vmw_tt->sgt.orig_nents,
 			 DMA_BIDIRECTIONAL);
+	/*
+	 * The cached mappings of unbound ttms may be what exhausted the
+	 * IOMMU address space. Give them up and retry once.
+	 */
+	if (unlikely(ret == 0) && vmw_ttm_dma_cache_flush(vmw_tt->dev_priv))
+		ret = dma_map_sg(dev, vmw_tt->sgt.sgl, vmw_tt->sgt.orig_nents,
+				 DMA_BIDIRECTIONAL);
 	if (unlikely(ret == 0))
 		return -ENOMEM;
 
 	vmw_tt->sgt.nents = ret;
+	atomic64_inc(&vmw_tt->dev_priv->dma_maps);
 
 	return 0;
 }
 
+/**
+ * vmw_ttm_dma_cache_del - Take a ttm off the DMA mapping cache
+ *
+ * @vmw_tt: Pointer to a struct vmw_ttm_tt
+ *
+ * The caller must hold the dma_cache_mutex.
+ */
+static void vmw_ttm_dma_cache_del(struct vmw_ttm_tt *vmw_tt)
+{
+	struct vmw_private *dev_priv = vmw_tt->dev_priv;
+
+	lockdep_assert_held(&dev_priv->dma_cache_mutex);
+
+	if (!list_empty(&vmw_tt->dma_cache_head)) {
+		list_del_init(&vmw_tt->dma_cache_head);
+		dev_priv->dma_cache_pages -= vmw_tt->dma_ttm.ttm.num_pages;
+	}
+}
+
 /**
  * vmw_ttm_map_dma - Make sure TTM pages are visible to the device
  *
@@ -423,6 +465,12 @@ static int vmw_ttm_map_dma(struct vmw_ttm_tt *vmw_tt)
 	static size_t sgl_size;
 	static size_t sgt_size;
 
+	if (dev_priv->map_mode == vmw_dma_map_bind) {
+		mutex_lock(&dev_priv->dma_cache_mutex);
+		vmw_ttm_dma_cache_del(vmw_tt);
+		mutex_unlock(&dev_priv->dma_cache_mutex);
+	}
+
 	if (vmw_tt->mapped)
 		return 0;
 
@@ -473,11 +521,14 @@ static int vmw_ttm_map_dma(struct vmw_ttm_tt *vmw_tt)
 
 	old = ~((dma_addr_t) 0);
 	vmw_tt->vsgt.num_regions = 0;
+	vmw_tt->vsgt.max_addr = 0;
 	for (vmw_piter_start(&iter, vsgt, 0); vmw_piter_next(&iter);) {
 		dma_addr_t cur = vmw_piter_dma_addr(&iter);
 
 		if (cur != old + PAGE_SIZE)
 			vmw_tt->vsgt.num_regions++;
+		if (cur > vmw_tt->vsgt.max_addr)
+			vmw_tt->vsgt.max_addr = cur;
 		old = cur;
 	}
 
@@ -493,7 +544,7 @@ out_sg_alloc_fail:
 }
 
 /**
- * vmw_ttm_unmap_dma - Tear down any TTM page device mappings
+ * __vmw_ttm_unmap_dma - Tear down any TTM page device mappings
  *
  * @vmw_tt: Pointer to a struct vmw_ttm_tt
  *
@@ -501,7 +552,7 @@ out_sg_alloc_fail:
  * any storage space allocated for them. If there are no mappings set up,
  * this function is a NOP.
  */
-static void vmw_ttm_unmap_dma(struct vmw_ttm_tt *vmw_tt)
+static void __vmw_ttm_unmap_dma(struct vmw_ttm_tt *vmw_tt)
 {
 	struct vmw_private *dev_priv = vmw_tt->dev_priv;
 
@@ -523,6 +574,83 @@ static void vmw_ttm_unmap_dma(struct vmw_ttm_tt *vmw_tt)
 	vmw_tt->mapped = false;
 }
 
+/**
+ * vmw_ttm_unmap_dma - Tear down any TTM page device mappings
+ *
+ * @vmw_tt: Pointer to a struct vmw_ttm_tt
+ *
+ * Like __vmw_ttm_unmap_dma, but also takes the ttm off the DMA mapping
+ * cache.
+ */
+static void vmw_ttm_unmap_dma(struct vmw_ttm_tt *vmw_tt)
+{
+	struct vmw_private *dev_priv = vmw_tt->dev_priv;
+
+	if (dev_priv->map_mode != vmw_dma_map_bind) {
+		__vmw_ttm_unmap_dma(vmw_tt);
+		return;
+	}
+
+	mutex_lock(&dev_priv->dma_cache_mutex);
+	vmw_ttm_dma_cache_del(vmw_tt);
+	__vmw_ttm_unmap_dma(vmw_tt);
+	mutex_unlock(&dev_priv->dma_cache_mutex);
+}
+
+/**
+ * vmw_ttm_dma_cache_add - Keep the DMA mappings of an unbound ttm
+ *
+ * @vmw_tt: Pointer to a struct vmw_ttm_tt
+ *
+ * Puts @vmw_tt at the tail of the DMA mapping cache, and tears down the
+ * mappings of the least recently unbound ttms while the cache holds more
+ * than VMW_DMA_CACHE_MAX_PAGES pages.
+ */
+static void vmw_ttm_dma_cache_add(struct vmw_ttm_tt *vmw_tt)
+{
+	struct vmw_private *dev_priv = vmw_tt->dev_priv;
+	struct vmw_ttm_tt *old;
+
+	mutex_lock(&dev_priv->dma_cache_mutex);
+	if (vmw_tt->mapped && list_empty(&vmw_tt->dma_cache_head)) {
+		list_add_tail(&vmw_tt->dma_cache_head, &dev_priv->dma_cache);
+		dev_priv->dma_cache_pages += vmw_tt->dma_ttm.ttm.num_pages;
+	}
+
+	while (dev_priv->dma_cache_pages > VMW_DMA_CACHE_MAX_PAGES) {
+		old = list_first_entry(&dev_priv->dma_cache, struct vmw_ttm_tt,
+				       dma_cache_head);
+		vmw_ttm_dma_cache_del(old);
+		__vmw_ttm_unmap_dma(old);
+	}
+	mutex_unlock(&dev_priv->dma_cache_mutex);
+}
+
+/**
+ * vmw_ttm_dma_cache_flush - Tear down all cached DMA mappings
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Returns true if any mappings were torn down.
+ */
+static bool vmw_ttm_dma_cache_flush(struct vmw_private *dev_priv)
+{
+	struct vmw_ttm_tt *old;
+	bool flushed = false;
+
+	mutex_lock(&dev_priv->dma_cache_mutex);
+	while (!list_empty(&dev_priv->dma_cache)) {
+		old = list_first_entry(&dev_priv->dma_cache, struct vmw_ttm_tt,
+				       dma_cache_head);
+		vmw_ttm_dma_cache_del(old);
+		__vmw_ttm_unmap_dma(old);
+		flushed = true;
+	}
+	mutex_unlock(&dev_priv->dma_cache_mutex);
+
+	return flushed;
+}
+
 
 /**
  * vmw_bo_map_dma - Make sure buffer object pages are visible to the device
@@ -631,7 +759,7 @@ static int vmw_ttm_unbind(struct ttm_tt *ttm)
 	}
 
 	if (vmw_be->dev_priv->map_mode == vmw_dma_map_bind)
-		vmw_ttm_unmap_dma(vmw_be);
+		vmw_ttm_dma_cache_add(vmw_be);
 
 	return 0;
 }
@@ -726,6 +854,7 @@ static struct ttm_tt *vmw_ttm_tt_create(struct ttm_bo_device *bdev,
 	vmw_be->dma_ttm.ttm.func = &vmw_ttm_func;
 	vmw_be->dev_priv = container_of(bdev, struct vmw_private, bdev);
 	vmw_be->mob = NULL;
+	INIT_LIST_HEAD(&vmw_be->dma_cache_head);
 
 	if (vmw_be->dev_priv->map_mode == vmw_dma_alloc_coherent)
 		ret = ttm_dma_tt_init(&vmw_be->dma_ttm, bdev, size, page_flags,
@@ -750,6 +879,9 @@ static int vmw_invalidate_caches(struct ttm_bo_device *bdev, uint32_t flags)
 static int vmw_init_mem_type(struct ttm_bo_device *bdev, uint32_t type,
 		      struct ttm_mem_type_manager *man)
 {
+	struct vmw_private *dev_priv =
+		container_of(bdev, struct vmw_private, bdev);
+
 	switch (type) {
 	case TTM_PL_SYSTEM:
 		/* System memory */
@@ -776,6 +908,17 @@ static int vmw_init_mem_type(struct ttm_bo_device *bdev, uint32_t type,
 		man->func = &vmw_gmrid_manager_func;
 		man->gpu_offset = 0;
 		man->flags = TTM_MEMTYPE_FLAG_CMA | TTM_MEMTYPE_FLAG_MAPPABLE;
+		/*
+		 * GMR and MOB unbinds are device commands executed after
+		 * all previously submitted commands, so eviction doesn't
+		 * need to wait for the bo to idle. The exception is
+		 * map_bind mode, where the DMA mappings of an unbound ttm
+		 * are kept in a cache from which they may be torn down at
+		 * any time, so the device must be done with the pages
+		 * before unbind.
+		 */
+		if (dev_priv->map_mode != vmw_dma_map_bind)
+			man->flags |= TTM_MEMTYPE_FLAG_ORDERED_UNBIND;
 		man->available_caching = TTM_PL_FLAG_CACHED;
 		man->default_caching = TTM_PL_FLAG_CACHED;
 		break;